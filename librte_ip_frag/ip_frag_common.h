@@ -34,6 +34,17 @@
 #ifndef _IP_FRAG_COMMON_H_
 #define _IP_FRAG_COMMON_H_
 
+#include <errno.h>
+
+#include <rte_mbuf.h>
+#include <rte_jhash.h>
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+#include <rte_hash_crc.h>
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_1
+#include <rte_vect.h>
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_1 */
+
 #include "rte_ip_frag.h"
 
 /* logging macros. */
@@ -51,30 +62,90 @@ if (!(exp))	{							\
 #define IP_FRAG_ASSERT(exp)	do {} while (0)
 #endif /* IP_FRAG_DEBUG */
 
-#define IPV4_KEYLEN 1
-#define IPV6_KEYLEN 4
+#ifdef RTE_LIBRTE_IP_FRAG_TBL_STAT
+#define	IP_FRAG_TBL_STAT_UPDATE(s, f, v)	((s)->f += (v))
+#else
+#define	IP_FRAG_TBL_STAT_UPDATE(s, f, v)	do {} while (0)
+#endif /* IP_FRAG_TBL_STAT */
+
+/* LRU list is not maintained with epoch aging */
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+#define	IP_FRAG_LRU_INSERT(tbl, fp)	TAILQ_INSERT_TAIL(&(tbl)->lru, (fp), lru)
+#define	IP_FRAG_LRU_REMOVE(tbl, fp)	TAILQ_REMOVE(&(tbl)->lru, (fp), lru)
+#else
+#define	IP_FRAG_LRU_INSERT(tbl, fp)	do {} while (0)
+#define	IP_FRAG_LRU_REMOVE(tbl, fp)	do {} while (0)
+
+/* TTL is split into at least that many epochs */
+#define	IP_FRAG_TTL_EPOCHS	64
+#endif /* RTE_LIBRTE_IP_FRAG_EPOCH_AGING */
+
+/* number of hash functions (buckets) per key */
+#define	IP_FRAG_HASH_FNUM	2
+
+/* keys hashed together by bulk hash and burst reassembly */
+#define	IP_FRAG_HASH_BURST	32
+
+/* how the caller of ip_frag_find() keeps fragments of the datagram */
+#define	IP_FRAG_FIND_REASSEMBLE	0	/* all of them, until reassembled */
+#define	IP_FRAG_FIND_FORWARD	1	/* those ahead of the first one */
+#define	IP_FRAG_FIND_FLOW	2	/* none, fragments are only tagged */
 
 /* helper macros */
 #define	IP_FRAG_MBUF2DR(dr, mb)	((dr)->row[(dr)->cnt++] = (mb))
 
+/*
+ * Key length known at compile time, or 0 - taken from the key.
+ * Functions with key length argument are instantiated for IPv4, IPv6
+ * and mixed tables, so that specialized ones have no branches on it.
+ */
+#define	IP_FRAG_KEY_LEN(key, len)	((len) != 0 ? (len) : (key)->key_len)
+
+#define	__ip_frag_always_inline	inline __attribute__((always_inline))
+
 #define IPv6_KEY_BYTES(key) \
 	(key)[0], (key)[1], (key)[2], (key)[3]
 #define IPv6_KEY_BYTES_FMT \
 	"%08" PRIx64 "%08" PRIx64 "%08" PRIx64 "%08" PRIx64
 
+/* fragment of a burst, as parsed before table lookup */
+struct ip_frag_desc {
+	uint16_t ofs;          /* offset into the datagram */
+	uint16_t len;          /* length of fragment */
+	uint16_t more_frags;   /* 0 for the last fragment */
+	uint16_t done;         /* datagram completed within the burst */
+};
+
 /* internal functions declarations */
-struct rte_mbuf * ip_frag_process(struct ip_frag_pkt *fp,
+struct rte_mbuf * ip_frag_process(struct rte_ip_frag_tbl *tbl,
+		struct ip_frag_pkt *fp,
 		struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb,
 		uint16_t ofs, uint16_t len, uint16_t more_frags);
 
+uint32_t ip_frag_forward(struct rte_ip_frag_tbl *tbl,
+		struct ip_frag_pkt *fp,
+		struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb,
+		uint16_t ofs, uint16_t len, uint16_t more_frags,
+		struct rte_mbuf **out);
+
+uint32_t ip_frag_flow(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+		struct rte_mbuf *mb, uint16_t ofs, uint16_t len,
+		uint16_t more_frags, uint32_t proto);
+
 struct ip_frag_pkt * ip_frag_find(struct rte_ip_frag_tbl *tbl,
 		struct rte_ip_frag_death_row *dr,
-		const struct ip_frag_key *key, uint64_t tms);
+		const struct ip_frag_key *key, const uint32_t *sig,
+		uint16_t ofs, uint16_t len, uint32_t mode, uint64_t tms);
 
 struct ip_frag_pkt * ip_frag_lookup(struct rte_ip_frag_tbl *tbl,
-	const struct ip_frag_key *key, uint64_t tms,
+	const struct ip_frag_key *key, const uint32_t *sig, uint64_t tms,
 	struct ip_frag_pkt **free, struct ip_frag_pkt **stale);
 
+uint32_t ip_frag_burst_reassemble(struct rte_ip_frag_tbl *tbl,
+	struct rte_mbuf **mb, const struct ip_frag_key *key,
+	const uint32_t *sig1, const uint32_t *sig2, struct ip_frag_desc *fd,
+	uint32_t num, uint64_t tms);
+
 void ip_frag_tbl_check_lru(struct rte_ip_frag_tbl *tbl,
 		struct rte_ip_frag_death_row *dr,
 		uint64_t tms);
@@ -93,96 +164,588 @@ struct rte_mbuf *ipv6_frag_reassemble(struct ip_frag_pkt *fp);
 static inline int
 ip_frag_key_is_empty(const struct ip_frag_key * key)
 {
-	uint32_t i;
-	for (i = 0; i < RTE_MIN(key->key_len, RTE_DIM(key->src_dst)); i++)
-		if (key->src_dst[i] != 0)
-			return 0;
-	return 1;
+	return (key->key_len == 0);
 }
 
 /* empty the key */
 static inline void
 ip_frag_key_invalidate(struct ip_frag_key * key)
+{
+	key->key_len = 0;
+}
+
+/*
+ * slot of the key in the recent entries cache: the id and the first
+ * address word folded together and multiplied by the golden ratio,
+ * cheaper than any of the table hashes.
+ */
+static inline uint32_t
+ip_frag_cache_idx(const struct ip_frag_key *key)
+{
+	uint32_t v;
+
+	v = key->id ^ (uint32_t)key->src_dst[0] ^
+		(uint32_t)(key->src_dst[0] >> 32);
+	return ((v * 0x9e3779b1) >> 24) & (IP_FRAG_CACHE_SIZE - 1);
+}
+
+/* drop the entry from recent entries cache, before its key is invalidated */
+static inline void
+ip_frag_cache_del(struct rte_ip_frag_tbl *tbl, const struct ip_frag_pkt *fp)
+{
+	uint32_t idx;
+
+	idx = ip_frag_cache_idx(&fp->key);
+	if (tbl->cache[idx] == fp)
+		tbl->cache[idx] = NULL;
+}
+
+/*
+ * compare two keys, k1 should not be empty.
+ * id and key_len are compared along with the addresses,
+ * so keys of different length or empty k2 never match.
+ */
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_1
+static __ip_frag_always_inline int
+ip_frag_key_cmp_len(const struct ip_frag_key *k1, const struct ip_frag_key *k2,
+	const uint32_t len)
+{
+	__m128i x;
+
+	x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)k1),
+		_mm_loadu_si128((const __m128i *)k2));
+
+	if (IP_FRAG_KEY_LEN(k1, len) == IPV6_KEYLEN) {
+		x = _mm_or_si128(x, _mm_xor_si128(
+			_mm_loadu_si128((const __m128i *)(k1->src_dst + 1)),
+			_mm_loadu_si128((const __m128i *)(k2->src_dst + 1))));
+		x = _mm_or_si128(x, _mm_xor_si128(
+			_mm_loadl_epi64((const __m128i *)(k1->src_dst + 3)),
+			_mm_loadl_epi64((const __m128i *)(k2->src_dst + 3))));
+	}
+
+	return !_mm_testz_si128(x, x);
+}
+#else
+static __ip_frag_always_inline int
+ip_frag_key_cmp_len(const struct ip_frag_key *k1, const struct ip_frag_key *k2,
+	const uint32_t len)
 {
 	uint32_t i;
-	for (i = 0; i < key->key_len; i++)
-		key->src_dst[i] = 0;
+	uint64_t val;
+
+	val = (k1->id ^ k2->id) | (k1->key_len ^ k2->key_len);
+	for (i = 0; i < IP_FRAG_KEY_LEN(k1, len); i++)
+		val |= k1->src_dst[i] ^ k2->src_dst[i];
+	return (val != 0);
 }
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_1 */
 
-/* compare two keys */
 static inline int
 ip_frag_key_cmp(const struct ip_frag_key * k1, const struct ip_frag_key * k2)
 {
-	uint32_t i, val;
-	val = k1->id ^ k2->id;
-	for (i = 0; i < k1->key_len; i++)
-		val |= k1->src_dst[i] ^ k2->src_dst[i];
-	return val;
+	return ip_frag_key_cmp_len(k1, k2, 0);
+}
+
+/*
+ * key hash functions
+ */
+
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+/* two CRC32 chains over the key words in opposite order */
+static __ip_frag_always_inline void
+ip_frag_hash_crc(const struct ip_frag_tbl_hash *hs,
+	const struct ip_frag_key *key, const uint32_t len,
+	uint32_t *v1, uint32_t *v2)
+{
+	const uint32_t *p;
+	uint32_t i, n, v, w;
+
+	p = (const uint32_t *)key->src_dst;
+	n = 2 * IP_FRAG_KEY_LEN(key, len);
+
+	v = hs->seed[0];
+	w = hs->seed[1];
+	for (i = 0; i != n; i++) {
+		v = rte_hash_crc_4byte(p[i], v);
+		w = rte_hash_crc_4byte(p[n - i - 1], w);
+	}
+
+	*v1 = rte_hash_crc_4byte(key->id, v);
+	*v2 = rte_hash_crc_4byte(key->id, w);
+}
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+
+static __ip_frag_always_inline uint32_t
+ip_frag_hash_jhash_one(const struct ip_frag_key *key, const uint32_t len,
+	uint32_t seed)
+{
+	const uint32_t *p;
+	uint32_t v;
+
+	p = (const uint32_t *)key->src_dst;
+
+	if (IP_FRAG_KEY_LEN(key, len) == IPV4_KEYLEN)
+		return rte_jhash_3words(p[0], p[1], key->id, seed);
+
+	v = rte_jhash_3words(p[0], p[1], p[2], seed);
+	v = rte_jhash_3words(p[3], p[4], p[5], v);
+	return rte_jhash_3words(p[6], p[7], key->id, v);
+}
+
+/* hash of the datagram L4 flow: addresses, protocol and L4 ports */
+static inline uint32_t
+ip_frag_flow_hash(const struct ip_frag_key *key, uint32_t proto,
+	uint32_t ports)
+{
+	const uint32_t *p;
+	uint32_t v;
+
+	p = (const uint32_t *)key->src_dst;
+
+	if (key->key_len == IPV4_KEYLEN)
+		return rte_jhash_3words(p[0], p[1], ports, proto);
+
+	v = rte_jhash_3words(p[0], p[1], p[2], proto);
+	v = rte_jhash_3words(p[3], p[4], p[5], v);
+	return rte_jhash_3words(p[6], p[7], ports, v);
+}
+
+/*
+ * Multiply-shift: high half of a0 + sum(a[i] * x[i]) mod 2^64
+ * is a strongly universal 32-bit hash of 32-bit key words x[].
+ */
+static __ip_frag_always_inline uint32_t
+ip_frag_hash_mulshift_one(const uint64_t *a, const struct ip_frag_key *key,
+	const uint32_t len)
+{
+	const uint32_t *p;
+	uint32_t i, n;
+	uint64_t v;
+
+	p = (const uint32_t *)key->src_dst;
+	n = 2 * IP_FRAG_KEY_LEN(key, len);
+
+	v = a[IP_FRAG_HASH_WORDS] + a[IP_FRAG_HASH_WORDS - 1] * key->id;
+	for (i = 0; i != n; i++)
+		v += a[i] * p[i];
+
+	return v >> 32;
+}
+
+/* hash values of the key for both of its buckets */
+static __ip_frag_always_inline void
+ip_frag_hash_len(const struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *key, const uint32_t len,
+	uint32_t *v1, uint32_t *v2)
+{
+	const struct ip_frag_tbl_hash *hs;
+
+	hs = &tbl->hash;
+
+	switch (hs->type) {
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+	case RTE_IP_FRAG_HASH_CRC:
+		ip_frag_hash_crc(hs, key, len, v1, v2);
+		break;
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+	case RTE_IP_FRAG_HASH_MULSHIFT:
+		*v1 = ip_frag_hash_mulshift_one(hs->mul[0], key, len);
+		*v2 = ip_frag_hash_mulshift_one(hs->mul[1], key, len);
+		break;
+	default:
+		*v1 = ip_frag_hash_jhash_one(key, len, hs->seed[0]);
+		*v2 = ip_frag_hash_jhash_one(key, len, hs->seed[1]);
+	}
+}
+
+static inline void
+ip_frag_hash(const struct rte_ip_frag_tbl *tbl, const struct ip_frag_key *key,
+	uint32_t *v1, uint32_t *v2)
+{
+	ip_frag_hash_len(tbl, key, 0, v1, v2);
 }
 
 /*
  * misc fragment functions
  */
 
+/* attach new overflow block to the entry, if slot idx starts one */
+static inline int
+ip_frag_ext_grow(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	uint32_t idx)
+{
+	struct ip_frag_ext *ext, **pext;
+
+	if (idx < IP_FRAG_INLINE_NUM ||
+			(idx - IP_FRAG_INLINE_NUM) % IP_FRAG_EXT_NUM != 0)
+		return 0;
+
+	if ((ext = tbl->ext_free) == NULL)
+		return -ENOSPC;
+
+	tbl->ext_free = ext->next;
+	tbl->use_ext++;
+	ext->next = NULL;
+
+	for (pext = &fp->ext; *pext != NULL; pext = &(*pext)->next)
+		;
+	*pext = ext;
+	return 0;
+}
+
+/* return all overflow blocks of the entry to the slab */
+static inline void
+ip_frag_ext_put(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp)
+{
+	struct ip_frag_ext *ext, *next;
+
+	for (ext = fp->ext; ext != NULL; ext = next) {
+		next = ext->next;
+		ext->next = tbl->ext_free;
+		tbl->ext_free = ext;
+		tbl->use_ext--;
+	}
+	fp->ext = NULL;
+}
+
+/*
+ * per-source quota functions
+ */
+
+/* sketch counters of the key source: IPv4 address or IPv6 /64 prefix */
+static inline void
+ip_frag_quota_idx(const struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *key, uint32_t idx[IP_FRAG_QUOTA_ROWS])
+{
+	const uint32_t *p;
+	uint32_t v;
+
+	p = (const uint32_t *)key->src_dst;
+	v = rte_jhash_3words(p[0], (key->key_len == IPV4_KEYLEN) ? 0 : p[1],
+		key->key_len, tbl->hash.seed[1]);
+
+	/* use different halves of the hash value for each row. */
+	idx[0] = v & tbl->quota.mask;
+	idx[1] = tbl->quota.mask + 1 + (((v >> 16) | (v << 16)) &
+		tbl->quota.mask);
+}
+
+/* estimate source counters: minimum over all rows */
+static inline struct ip_frag_src_cnt
+ip_frag_quota_get(const struct rte_ip_frag_tbl *tbl,
+	const uint32_t idx[IP_FRAG_QUOTA_ROWS])
+{
+	struct ip_frag_src_cnt c;
+	uint32_t i;
+
+	c = tbl->quota.cnt[idx[0]];
+	for (i = 1; i != IP_FRAG_QUOTA_ROWS; i++) {
+		c.pkts = RTE_MIN(c.pkts, tbl->quota.cnt[idx[i]].pkts);
+		c.bytes = RTE_MIN(c.bytes, tbl->quota.cnt[idx[i]].bytes);
+	}
+	return c;
+}
+
+/* adjust source counters, never going below zero */
+static inline void
+ip_frag_quota_add(struct rte_ip_frag_tbl *tbl,
+	const uint32_t idx[IP_FRAG_QUOTA_ROWS], int32_t pkts, int32_t bytes)
+{
+	struct ip_frag_src_cnt *c;
+	uint32_t i;
+
+	for (i = 0; i != IP_FRAG_QUOTA_ROWS; i++) {
+		c = tbl->quota.cnt + idx[i];
+		c->pkts = (pkts < 0 && c->pkts < (uint32_t)-pkts) ?
+			0 : c->pkts + pkts;
+		c->bytes = (bytes < 0 && c->bytes < (uint32_t)-bytes) ?
+			0 : c->bytes + bytes;
+	}
+}
+
+/* account datagrams/bytes of the entry's source, if quotas are enabled */
+static inline void
+ip_frag_quota_update(struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *key, int32_t pkts, int32_t bytes)
+{
+	uint32_t idx[IP_FRAG_QUOTA_ROWS];
+
+	if (likely(tbl->quota.cnt == NULL))
+		return;
+
+	ip_frag_quota_idx(tbl, key, idx);
+	ip_frag_quota_add(tbl, idx, pkts, bytes);
+}
+
+/* release buffered bytes and mbufs of the entry from table accounting */
+static inline void
+ip_frag_mem_put(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp)
+{
+	tbl->mem.bytes -= fp->frag_size;
+	tbl->mem.mbufs -= fp->nb_mbufs;
+	fp->nb_mbufs = 0;
+}
+
 /* put fragment on death row */
 static inline void
-ip_frag_free(struct ip_frag_pkt *fp, struct rte_ip_frag_death_row *dr)
+ip_frag_free(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	struct rte_ip_frag_death_row *dr)
 {
-	uint32_t i, k;
+	struct ip_frag_ext *ext;
+	struct ip_frag *frag;
+	struct rte_mbuf *buf;
+	uint32_t i, k, n;
+
+	/* buf shares its place with flow of forwarded datagrams. */
+	buf = (tbl->copy_pool != NULL) ? fp->buf : NULL;
 
 	k = dr->cnt;
+	n = RTE_MIN(fp->last_idx, (uint32_t)IP_FRAG_INLINE_NUM);
+	frag = fp->frags;
+	ext = fp->ext;
+
 	for (i = 0; i != fp->last_idx; i++) {
-		if (fp->frags[i].mb != NULL) {
-			IP_FRAG_LOG(INFO, "Free mbuf %p\n", fp->frags[i].mb);
-			dr->row[k++] = fp->frags[i].mb;
-			fp->frags[i].mb = NULL;
+
+		/* move on to the next overflow block. */
+		if (i == n) {
+			frag = ext->frags;
+			ext = ext->next;
+			n += IP_FRAG_EXT_NUM;
 		}
+
+		if (frag->mb != NULL && frag->mb != buf) {
+			IP_FRAG_LOG(INFO, "Free mbuf %p\n", frag->mb);
+			dr->row[k++] = frag->mb;
+		}
+		frag->mb = NULL;
+		frag++;
 	}
 
+	/* copy mode buffer is shared by all used slots. */
+	if (buf != NULL) {
+		IP_FRAG_LOG(INFO, "Free mbuf %p\n", buf);
+		dr->row[k++] = buf;
+		fp->buf = NULL;
+	}
+
+	ip_frag_ext_put(tbl, fp);
+	ip_frag_mem_put(tbl, fp);
+	ip_frag_quota_update(tbl, &fp->key, 0, -(int32_t)fp->frag_size);
 	fp->last_idx = 0;
 	dr->cnt = k;
 }
 
+/*
+ * account fragments, whose mbufs come from another socket's pool.
+ * Nothing is rejected, debug builds log each of them.
+ */
+static inline void
+ip_frag_socket_check(struct rte_ip_frag_tbl *tbl, const struct rte_mbuf *mb)
+{
+	uint32_t xsocket;
+
+	xsocket = (tbl->socket_id != SOCKET_ID_ANY &&
+		mb->pool->socket_id != tbl->socket_id);
+	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, xsocket_num, xsocket);
+
+	if (xsocket != 0)
+		IP_FRAG_LOG(WARNING, "%s: mbuf %p from socket %d, "
+			"table %p on socket %d\n", __func__, mb,
+			mb->pool->socket_id, tbl, tbl->socket_id);
+}
+
+/* recalculate resize thresholds, after max_entries change */
+static inline void
+ip_frag_tbl_resize_limits(struct rte_ip_frag_tbl *tbl)
+{
+	tbl->resize.grow_use = (uint32_t)((uint64_t)tbl->max_entries *
+		tbl->resize.grow_load / 100);
+	tbl->resize.shrink_use = (uint32_t)((uint64_t)tbl->max_entries *
+		tbl->resize.shrink_load / 100);
+}
+
+/*
+ * entry aging functions
+ */
+
+/* entry start value for the given time */
+static inline uint64_t
+ip_frag_stamp(const struct rte_ip_frag_tbl *tbl, uint64_t tms)
+{
+#ifdef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	return (uint32_t)(tms >> tbl->epoch_shift);
+#else
+	RTE_SET_USED(tbl);
+	return tms;
+#endif
+}
+
+/* time since entry start, in units of start */
+static inline uint64_t
+ip_frag_age(const struct rte_ip_frag_tbl *tbl, const struct ip_frag_pkt *fp,
+	uint64_t tms)
+{
+#ifdef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	return (uint32_t)(ip_frag_stamp(tbl, tms) - fp->start);
+#else
+	RTE_SET_USED(tbl);
+	return tms - fp->start;
+#endif
+}
+
+/*
+ * entries started before the returned value have expired ttl,
+ * computed once per lookup, so each entry check is a single compare.
+ */
+static inline uint64_t
+ip_frag_deadline(const struct rte_ip_frag_tbl *tbl, uint64_t tms)
+{
+#ifdef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	return (uint32_t)(ip_frag_stamp(tbl, tms) - tbl->max_epochs);
+#else
+	return (tms > tbl->max_cycles) ? tms - tbl->max_cycles : 0;
+#endif
+}
+
+/* check if entry ttl has expired by the deadline */
+static inline int
+ip_frag_expired_by(const struct ip_frag_pkt *fp, uint64_t deadline)
+{
+#ifdef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	/* epochs wrap around. */
+	return (int32_t)(fp->start - (uint32_t)deadline) < 0;
+#else
+	return fp->start < deadline;
+#endif
+}
+
+/* check if entry ttl has expired */
+static inline int
+ip_frag_expired(const struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_pkt *fp, uint64_t tms)
+{
+	return ip_frag_expired_by(fp, ip_frag_deadline(tbl, tms));
+}
+
 /* if key is empty, mark key as in use */
 static inline void
-ip_frag_inuse(struct rte_ip_frag_tbl *tbl, const struct  ip_frag_pkt *fp)
+ip_frag_inuse(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp)
 {
 	if (ip_frag_key_is_empty(&fp->key)) {
-		TAILQ_REMOVE(&tbl->lru, fp, lru);
+		IP_FRAG_LRU_REMOVE(tbl, fp);
 		tbl->use_entries--;
 	}
 }
 
-/* reset the fragment */
+/* reset the fragment, start is ip_frag_stamp() of the current time */
 static inline void
-ip_frag_reset(struct ip_frag_pkt *fp, uint64_t tms)
+ip_frag_reset(struct ip_frag_pkt *fp, uint64_t start)
 {
 	static const struct ip_frag zero_frag = {
 		.ofs = 0,
 		.len = 0,
 		.mb = NULL,
+		.tail = NULL,
 	};
 
-	fp->start = tms;
+	fp->start = start;
 	fp->total_size = UINT32_MAX;
 	fp->frag_size = 0;
+	fp->nb_mbufs = 0;
+	fp->ref = 0;
 	fp->last_idx = IP_MIN_FRAG_NUM;
+	fp->buf = NULL;
 	fp->frags[IP_LAST_FRAG_IDX] = zero_frag;
 	fp->frags[IP_FIRST_FRAG_IDX] = zero_frag;
 }
 
-/* chain two mbufs */
+/* copy len bytes of mbuf chain from offset off, segments could be short */
 static inline void
-ip_frag_chain(struct rte_mbuf *mn, struct rte_mbuf *mp)
+ip_frag_copy_data(char *dst, const struct rte_mbuf *mb, uint32_t off,
+	uint32_t len)
+{
+	uint32_t n;
+
+	for (; len != 0 && mb != NULL; mb = mb->next) {
+		if (off >= mb->data_len) {
+			off -= mb->data_len;
+			continue;
+		}
+
+		n = RTE_MIN(len, mb->data_len - off);
+		rte_memcpy(dst, rte_pktmbuf_mtod_offset(mb, char *, off), n);
+		dst += n;
+		len -= n;
+		off = 0;
+	}
+}
+
+/*
+ * copy mode: take the datagram buffer, with the header of the first
+ * fragment in front of the payload. Slots keep pointing to it.
+ */
+static inline struct rte_mbuf *
+ip_frag_copy_take(struct ip_frag_pkt *fp)
+{
+	struct rte_mbuf *m;
+	uint32_t hlen;
+
+	m = fp->buf;
+	hlen = m->l2_len + m->l3_len;
+
+	m->data_off = (uint16_t)(m->data_off - hlen);
+	m->data_len = (uint16_t)(hlen + fp->total_size);
+	m->pkt_len = m->data_len;
+
+	fp->buf = NULL;
+	return m;
+}
+
+/*
+ * strip len header bytes of fragment, they could span several
+ * leading segments of a scattered fragment. Segments left empty are
+ * freed, so the fragment could start with another segment, it is
+ * returned. The last segment is always kept.
+ */
+static inline struct rte_mbuf *
+ip_frag_adj(struct rte_mbuf *mb, uint32_t len)
 {
 	struct rte_mbuf *ms;
+	uint32_t pkt_len;
+	uint8_t nb_segs;
+
+	len = RTE_MIN(len, mb->pkt_len);
+	pkt_len = mb->pkt_len - len;
+	nb_segs = mb->nb_segs;
+
+	while (len >= mb->data_len && mb->next != NULL) {
+		len -= mb->data_len;
+		ms = mb->next;
+		rte_pktmbuf_free_seg(mb);
+		mb = ms;
+		nb_segs--;
+	}
 
+	mb->data_off = (uint16_t)(mb->data_off + len);
+	mb->data_len = (uint16_t)(mb->data_len - len);
+	mb->pkt_len = pkt_len;
+	mb->nb_segs = nb_segs;
+	return mb;
+}
+
+/*
+ * chain mbuf mp after mn, mt is the last segment of mn,
+ * so linking doesn't depend on segments per fragment.
+ */
+static inline void
+ip_frag_chain(struct rte_mbuf *mn, struct rte_mbuf *mt, struct rte_mbuf *mp)
+{
 	/* adjust start of the last fragment data. */
-	rte_pktmbuf_adj(mp, (uint16_t)(mp->l2_len + mp->l3_len));
+	mp = ip_frag_adj(mp, mp->l2_len + mp->l3_len);
 
 	/* chain two fragments. */
-	ms = rte_pktmbuf_lastseg(mn);
-	ms->next = mp;
+	mt->next = mp;
 
 	/* accumulate number of segments and total length. */
 	mn->nb_segs = (uint8_t)(mn->nb_segs + mp->nb_segs);
@@ -193,5 +756,64 @@ ip_frag_chain(struct rte_mbuf *mn, struct rte_mbuf *mp)
 	mp->nb_segs = 1;
 }
 
+/*
+ * mbuf owning the data of segment m: an indirect segment
+ * can't be attached to, only its direct one.
+ */
+static inline struct rte_mbuf *
+ip_frag_direct(struct rte_mbuf *m)
+{
+	return RTE_MBUF_INDIRECT(m) ? RTE_MBUF_FROM_BADDR(m->buf_addr) : m;
+}
+
+/* keyed hash of an IPv4 (1 word) or IPv6 (4 words) address */
+static inline uint32_t
+ip_frag_addr_hash(const uint32_t *addr, uint32_t words, uint32_t seed)
+{
+	uint32_t i, v;
+
+	v = seed;
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+	for (i = 0; i != words; i++)
+		v = rte_hash_crc_4byte(addr[i], v);
+#else
+	for (i = 0; i != words; i++)
+		v = rte_jhash_1word(addr[i], v);
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+	return v;
+}
+
+/*
+ * MTU to fragment len bytes of payload with, when each fragment carries
+ * hlen bytes of headers, following the sizing mode of rte_ip_frag.h.
+ * Payload per fragment is kept a multiple of 8.
+ */
+static inline uint16_t
+ip_frag_size_mtu(uint32_t mode, uint32_t buf_size, uint32_t mtu,
+	uint32_t hlen, uint32_t len)
+{
+	uint32_t max, n;
+
+	/* too small to do anything about. */
+	if (mtu < hlen + 8)
+		return (uint16_t)mtu;
+
+	max = RTE_ALIGN_FLOOR(mtu - hlen, 8);
+
+	switch (mode) {
+	case RTE_IP_FRAG_SIZE_EQUAL:
+		n = (len + max - 1) / max;
+		if (n > 1)
+			max = RTE_ALIGN_CEIL((len + n - 1) / n, 8);
+		break;
+	case RTE_IP_FRAG_SIZE_BUF:
+		n = (buf_size != 0) ? mtu / buf_size * buf_size : 0;
+		if (n >= hlen + 8)
+			max = RTE_ALIGN_FLOOR(n - hlen, 8);
+		break;
+	}
+
+	return (uint16_t)(hlen + max);
+}
 
 #endif /* _IP_FRAG_COMMON_H_ */
@@ -33,32 +33,159 @@
 
 #include <stddef.h>
 
-#include <rte_jhash.h>
-#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
-#include <rte_hash_crc.h>
-#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
-
 #include "ip_frag_common.h"
 
-#define	PRIME_VALUE	0xeaad8405
+/* death row room to keep for the fragment itself, when dropping entries */
+#define	IP_FRAG_DR_RESERVE	(3 * (IP_MAX_FRAG_NUM + 1))
+
+/* oldest entries to choose from, when evicting by size or completion */
+#define	IP_FRAG_EVICT_SAMPLE	8
+
+/* used entries the CLOCK hand may check in one victim search */
+#define	IP_FRAG_CLOCK_STEPS	(4 * IP_FRAG_EVICT_SAMPLE)
 
 #define	IP_FRAG_TBL_POS(tbl, sig)	\
 	((tbl)->pkt + ((sig) & (tbl)->entry_mask))
 
-#ifdef RTE_LIBRTE_IP_FRAG_TBL_STAT
-#define	IP_FRAG_TBL_STAT_UPDATE(s, f, v)	((s)->f += (v))
+/*
+ * Trace hook for each entry checked by lookup. It is compiled out
+ * without debug, so that lookup loops only branch on the entry state.
+ */
+#ifdef RTE_LIBRTE_IP_FRAG_DEBUG
+#define	IP_FRAG_TRACE_ENTRY(tbl, line, p, i)	\
+	ip_frag_trace_entry(__func__, __LINE__, tbl, line, p, i)
+
+static void
+ip_frag_trace_entry(const char *func, int ln,
+	const struct rte_ip_frag_tbl *tbl, uint32_t line,
+	const struct ip_frag_pkt *p, uint32_t i)
+{
+	if (p[i].key.key_len == IPV4_KEYLEN)
+		IP_FRAG_LOG(DEBUG, "%s:%d:\n"
+			"tbl: %p, max_entries: %u, use_entries: %u\n"
+			"ipv4_frag_pkt line%u: %p, index: %u from %u\n"
+			"key: <%" PRIx64 ", %#x>, start: %" PRIu64 "\n",
+			func, ln, tbl, tbl->max_entries, tbl->use_entries,
+			line, p, i, tbl->bucket_entries,
+			p[i].key.src_dst[0], p[i].key.id, (uint64_t)p[i].start);
+	else
+		IP_FRAG_LOG(DEBUG, "%s:%d:\n"
+			"tbl: %p, max_entries: %u, use_entries: %u\n"
+			"ipv6_frag_pkt line%u: %p, index: %u from %u\n"
+			"key: <" IPv6_KEY_BYTES_FMT ", %#x>, start: %" PRIu64 "\n",
+			func, ln, tbl, tbl->max_entries, tbl->use_entries,
+			line, p, i, tbl->bucket_entries,
+			IPv6_KEY_BYTES(p[i].key.src_dst), p[i].key.id,
+			(uint64_t)p[i].start);
+}
 #else
-#define	IP_FRAG_TBL_STAT_UPDATE(s, f, v)	do {} while (0)
-#endif /* IP_FRAG_TBL_STAT */
+#define	IP_FRAG_TRACE_ENTRY(tbl, line, p, i)	do {} while (0)
+#endif /* RTE_LIBRTE_IP_FRAG_DEBUG */
+
+/*
+ * tombstone filter: Bloom filter of keys of finished datagrams, indexed by
+ * both hash values of the key. Of its two generations, keys are added to
+ * the current one and looked up in both, the older one is cleared when
+ * the current one is a period old.
+ */
+static inline uint64_t *
+ip_frag_tomb_gen(const struct ip_frag_tbl_tomb *tb, uint32_t gen)
+{
+	return tb->bits + (size_t)gen * ((tb->mask + 1) / 64);
+}
+
+static inline void
+ip_frag_tomb_set(struct rte_ip_frag_tbl *tbl, uint32_t sig1, uint32_t sig2)
+{
+	uint64_t *bits;
+
+	bits = ip_frag_tomb_gen(&tbl->tomb, tbl->tomb.cur);
+	sig1 &= tbl->tomb.mask;
+	sig2 &= tbl->tomb.mask;
+	bits[sig1 / 64] |= 1ULL << (sig1 % 64);
+	bits[sig2 / 64] |= 1ULL << (sig2 % 64);
+}
+
+static inline int
+ip_frag_tomb_test(const struct rte_ip_frag_tbl *tbl, uint32_t sig1,
+	uint32_t sig2)
+{
+	const uint64_t *bits;
+	uint32_t i;
+
+	sig1 &= tbl->tomb.mask;
+	sig2 &= tbl->tomb.mask;
+	for (i = 0; i != 2; i++) {
+		bits = ip_frag_tomb_gen(&tbl->tomb, i);
+		if ((bits[sig1 / 64] & 1ULL << (sig1 % 64)) != 0 &&
+				(bits[sig2 / 64] & 1ULL << (sig2 % 64)) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* record key of the datagram leaving the table */
+static inline void
+ip_frag_tomb_add(struct rte_ip_frag_tbl *tbl, const struct ip_frag_key *key)
+{
+	uint32_t sig1, sig2;
+
+	if (likely(tbl->tomb.bits == NULL))
+		return;
+
+	ip_frag_hash(tbl, key, &sig1, &sig2);
+	ip_frag_tomb_set(tbl, sig1, sig2);
+}
+
+/* check whether the key was recorded, sig holds its hash values or NULL */
+static inline int
+ip_frag_tomb_find(const struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *key, const uint32_t *sig)
+{
+	uint32_t sig1, sig2;
+
+	if (sig != NULL) {
+		sig1 = sig[0];
+		sig2 = sig[1];
+	} else
+		ip_frag_hash(tbl, key, &sig1, &sig2);
+
+	return ip_frag_tomb_test(tbl, sig1, sig2);
+}
+
+/* start a new generation, when the current one is a period old */
+static inline void
+ip_frag_tomb_age(struct rte_ip_frag_tbl *tbl, uint64_t tms)
+{
+	struct ip_frag_tbl_tomb *tb;
+	size_t sz;
+
+	tb = &tbl->tomb;
+	if (tms - tb->start < tb->period)
+		return;
+
+	sz = (tb->mask + 1) / 8;
+	tb->cur ^= 1;
+	memset(ip_frag_tomb_gen(tb, tb->cur), 0, sz);
+
+	/* both generations are too old. */
+	if (tms - tb->start >= 2 * tb->period)
+		memset(ip_frag_tomb_gen(tb, tb->cur ^ 1), 0, sz);
+
+	tb->start = tms;
+}
 
 /* local frag table helper functions */
 static inline void
 ip_frag_tbl_del(struct rte_ip_frag_tbl *tbl, struct rte_ip_frag_death_row *dr,
 	struct ip_frag_pkt *fp)
 {
-	ip_frag_free(fp, dr);
+	ip_frag_free(tbl, fp, dr);
+	ip_frag_quota_update(tbl, &fp->key, -1, 0);
+	ip_frag_cache_del(tbl, fp);
+	ip_frag_tomb_add(tbl, &fp->key);
 	ip_frag_key_invalidate(&fp->key);
-	TAILQ_REMOVE(&tbl->lru, fp, lru);
+	IP_FRAG_LRU_REMOVE(tbl, fp);
 	tbl->use_entries--;
 	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, del_num, 1);
 }
@@ -68,8 +195,8 @@ ip_frag_tbl_add(struct rte_ip_frag_tbl *tbl,  struct ip_frag_pkt *fp,
 	const struct ip_frag_key *key, uint64_t tms)
 {
 	fp->key = key[0];
-	ip_frag_reset(fp, tms);
-	TAILQ_INSERT_TAIL(&tbl->lru, fp, lru);
+	ip_frag_reset(fp, ip_frag_stamp(tbl, tms));
+	IP_FRAG_LRU_INSERT(tbl, fp);
 	tbl->use_entries++;
 	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, add_num, 1);
 }
@@ -78,64 +205,382 @@ static inline void
 ip_frag_tbl_reuse(struct rte_ip_frag_tbl *tbl, struct rte_ip_frag_death_row *dr,
 	struct ip_frag_pkt *fp, uint64_t tms)
 {
-	ip_frag_free(fp, dr);
-	ip_frag_reset(fp, tms);
-	TAILQ_REMOVE(&tbl->lru, fp, lru);
-	TAILQ_INSERT_TAIL(&tbl->lru, fp, lru);
+	ip_frag_free(tbl, fp, dr);
+	ip_frag_reset(fp, ip_frag_stamp(tbl, tms));
+	IP_FRAG_LRU_REMOVE(tbl, fp);
+	IP_FRAG_LRU_INSERT(tbl, fp);
 	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, reuse_num, 1);
 }
 
 
-static inline void
-ipv4_frag_hash(const struct ip_frag_key *key, uint32_t *v1, uint32_t *v2)
+/*
+ * Move entry from the old entries array into the current one.
+ * If both of its buckets are full, the entry is dropped.
+ */
+static inline int
+ip_frag_tbl_migrate(struct rte_ip_frag_tbl *tbl,
+	struct rte_ip_frag_death_row *dr, struct ip_frag_pkt *op)
 {
-	uint32_t v;
-	const uint32_t *p;
+	struct ip_frag_pkt *p1, *p2, *np;
+	uint32_t i, idx, sig1, sig2;
 
-	p = (const uint32_t *)&key->src_dst;
+	ip_frag_hash(tbl, &op->key, &sig1, &sig2);
 
-#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
-	v = rte_hash_crc_4byte(p[0], PRIME_VALUE);
-	v = rte_hash_crc_4byte(p[1], v);
-	v = rte_hash_crc_4byte(key->id, v);
-#else
+	p1 = IP_FRAG_TBL_POS(tbl, sig1);
+	p2 = IP_FRAG_TBL_POS(tbl, sig2);
+
+	np = NULL;
+	for (i = 0; i != tbl->bucket_entries && np == NULL; i++) {
+		if (ip_frag_key_is_empty(&p1[i].key))
+			np = p1 + i;
+		else if (ip_frag_key_is_empty(&p2[i].key))
+			np = p2 + i;
+	}
+
+	if (np == NULL) {
+
+		/* leave room on death row for the fragment being processed. */
+		if (dr->cnt + IP_FRAG_DR_RESERVE > RTE_DIM(dr->row))
+			return -ENOSPC;
+
+		ip_frag_tbl_del(tbl, dr, op);
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, mig_drop, 1);
+		return 0;
+	}
+
+	/* take over position of the old entry in the LRU list. */
+	*np = *op;
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	TAILQ_INSERT_BEFORE(op, np, lru);
+	TAILQ_REMOVE(&tbl->lru, op, lru);
+#endif
+	ip_frag_key_invalidate(&op->key);
 
-	v = rte_jhash_3words(p[0], p[1], key->id, PRIME_VALUE);
-#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+	idx = ip_frag_cache_idx(&np->key);
+	if (tbl->cache[idx] == op)
+		tbl->cache[idx] = np;
 
-	*v1 =  v;
-	*v2 = (v << 7) + (v >> 14);
+	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, mig_num, 1);
+	return 0;
 }
 
-static inline void
-ipv6_frag_hash(const struct ip_frag_key *key, uint32_t *v1, uint32_t *v2)
-{
-	uint32_t v;
-	const uint32_t *p;
-
-	p = (const uint32_t *) &key->src_dst;
-
-#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
-	v = rte_hash_crc_4byte(p[0], PRIME_VALUE);
-	v = rte_hash_crc_4byte(p[1], v);
-	v = rte_hash_crc_4byte(p[2], v);
-	v = rte_hash_crc_4byte(p[3], v);
-	v = rte_hash_crc_4byte(p[4], v);
-	v = rte_hash_crc_4byte(p[5], v);
-	v = rte_hash_crc_4byte(p[6], v);
-	v = rte_hash_crc_4byte(p[7], v);
-	v = rte_hash_crc_4byte(key->id, v);
+/* start migration into the spare entries array */
+static void
+ip_frag_tbl_resize_start(struct rte_ip_frag_tbl *tbl)
+{
+	struct ip_frag_tbl_resize *rs;
+	struct ip_frag_pkt *pkt;
+	uint32_t nb_entries;
+
+	rs = &tbl->resize;
+	pkt = rs->spare;
+	nb_entries = rs->spare_nb_entries;
+	rs->spare = NULL;
+	rs->spare_nb_entries = 0;
+	rs->want = 0;
+
+	if (nb_entries > tbl->nb_entries)
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, grow_num, 1);
+	else
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, shrink_num, 1);
+
+	rs->old = tbl->pkt;
+	rs->old_mask = tbl->entry_mask;
+	rs->old_nb_entries = tbl->nb_entries;
+	rs->pos = 0;
+
+	tbl->max_entries = (uint32_t)((uint64_t)tbl->max_entries * nb_entries /
+		tbl->nb_entries);
+	tbl->nb_buckets = (uint32_t)((uint64_t)tbl->nb_buckets * nb_entries /
+		tbl->nb_entries);
+	tbl->pkt = pkt;
+	tbl->nb_entries = nb_entries;
+	tbl->entry_mask = (nb_entries - 1) & ~(tbl->bucket_entries - 1);
+
+	ip_frag_tbl_resize_limits(tbl);
+}
+
+/*
+ * Check table load and ask for resize if needed, start it once
+ * the spare array is there, or migrate next few buckets,
+ * if resize is in progress.
+ */
+static void
+ip_frag_tbl_resize(struct rte_ip_frag_tbl *tbl,
+	struct rte_ip_frag_death_row *dr)
+{
+	struct ip_frag_tbl_resize *rs;
+	uint32_t i, n;
+
+	rs = &tbl->resize;
+
+	if (rs->old == NULL) {
+		if (tbl->use_entries >= rs->grow_use &&
+				tbl->nb_entries < rs->max_entries)
+			rs->want = tbl->nb_entries * 2;
+		else if (tbl->use_entries < rs->shrink_use &&
+				tbl->nb_entries > rs->min_entries)
+			rs->want = tbl->nb_entries / 2;
+		else
+			rs->want = 0;
+
+		if (rs->want != 0 && rs->spare_nb_entries == rs->want)
+			ip_frag_tbl_resize_start(tbl);
+		return;
+	}
+
+	n = RTE_MIN(rs->pos + rs->step * tbl->bucket_entries,
+		rs->old_nb_entries);
+
+	for (i = rs->pos; i != n; i++) {
+		if (!ip_frag_key_is_empty(&rs->old[i].key) &&
+				ip_frag_tbl_migrate(tbl, dr, rs->old + i) != 0)
+			break;
+	}
+	rs->pos = i;
+
+	/* all entries are moved, old array is freed out of the packet path. */
+	if (rs->pos == rs->old_nb_entries) {
+		IP_FRAG_ASSERT(rs->retired == NULL);
+		memset(tbl->cache, 0, sizeof(tbl->cache));
+		rs->retired = rs->old;
+		rs->retired_nb_entries = rs->old_nb_entries;
+		rs->old = NULL;
+	}
+}
+
+/* lookup the key in not yet migrated buckets of the old entries array */
+static __ip_frag_always_inline struct ip_frag_pkt *
+ip_frag_lookup_old(const struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *key, uint32_t sig1, uint32_t sig2,
+	const uint32_t len)
+{
+	const struct ip_frag_tbl_resize *rs;
+	struct ip_frag_pkt *p;
+	uint32_t i, k, pos, sig[IP_FRAG_HASH_FNUM];
+
+	rs = &tbl->resize;
+	sig[0] = sig1;
+	sig[1] = sig2;
+
+	for (k = 0; k != RTE_DIM(sig); k++) {
+		pos = sig[k] & rs->old_mask;
+		if (pos + tbl->bucket_entries <= rs->pos)
+			continue;
+
+		p = rs->old + pos;
+		for (i = 0; i != tbl->bucket_entries; i++)
+			if (ip_frag_key_cmp_len(key, &p[i].key, len) == 0)
+				return p + i;
+	}
+
+	return NULL;
+}
+
+/*
+ * Check that one more fragment (and datagram, if new is set) from the key's
+ * source fits into the quota. Fills sketch indexes of the source.
+ */
+static inline int
+ip_frag_quota_check(struct rte_ip_frag_tbl *tbl, const struct ip_frag_key *key,
+	uint32_t new, uint16_t len, uint32_t idx[IP_FRAG_QUOTA_ROWS])
+{
+	struct ip_frag_src_cnt c;
+
+	ip_frag_quota_idx(tbl, key, idx);
+	c = ip_frag_quota_get(tbl, idx);
+
+	if ((tbl->quota.max_pkts != 0 &&
+			c.pkts + new > tbl->quota.max_pkts) ||
+			(tbl->quota.max_bytes != 0 &&
+			(uint64_t)c.bytes + len > tbl->quota.max_bytes)) {
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_quota, 1);
+		return -EDQUOT;
+	}
+
+	return 0;
+}
+
+/* check if entry fp should be evicted before vp */
+static inline int
+ip_frag_evict_before(const struct rte_ip_frag_tbl *tbl, uint32_t policy,
+	const struct ip_frag_pkt *fp, const struct ip_frag_pkt *vp,
+	uint64_t tms)
+{
+	switch (policy) {
+	case RTE_IP_FRAG_EVICT_OLDEST:
+	case RTE_IP_FRAG_EVICT_EXPIRED:
+		return ip_frag_age(tbl, fp, tms) > ip_frag_age(tbl, vp, tms);
+	case RTE_IP_FRAG_EVICT_LARGEST:
+		return fp->frag_size > vp->frag_size;
+	case RTE_IP_FRAG_EVICT_LEAST_COMPLETE:
+		/* total_size is UINT32_MAX, until the last fragment arrives. */
+		return (uint64_t)fp->frag_size * vp->total_size <
+			(uint64_t)vp->frag_size * fp->total_size;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Return entry under the given hand and advance it. While resize is in
+ * progress, the hand also passes not yet migrated part of the old array.
+ */
+static inline struct ip_frag_pkt *
+ip_frag_tbl_next(struct rte_ip_frag_tbl *tbl, uint32_t *hand)
+{
+	const struct ip_frag_tbl_resize *rs;
+	uint32_t n, pos;
+
+	rs = &tbl->resize;
+	n = tbl->nb_entries;
+	pos = *hand;
+
+	if (pos >= n && (rs->old == NULL || pos - n >= rs->old_nb_entries))
+		pos = 0;
+
+	if (pos < n) {
+		*hand = pos + 1;
+		return tbl->pkt + pos;
+	}
+
+	pos = RTE_MAX(pos, n + rs->pos);
+	*hand = pos + 1;
+	return rs->old + pos - n;
+}
+
+/* return entry under the CLOCK hand and advance it */
+static inline struct ip_frag_pkt *
+ip_frag_tbl_hand(struct rte_ip_frag_tbl *tbl)
+{
+	return ip_frag_tbl_next(tbl, &tbl->clock_hand);
+}
+
+/* entries the CLOCK hand passes in one pass over both arrays */
+static inline uint32_t
+ip_frag_tbl_hand_steps(const struct rte_ip_frag_tbl *tbl)
+{
+	const struct ip_frag_tbl_resize *rs;
+
+	rs = &tbl->resize;
+	if (rs->old == NULL)
+		return tbl->nb_entries;
+	return tbl->nb_entries + rs->old_nb_entries - rs->pos;
+}
+
+/*
+ * Sweep entries for the first one not hit since the previous sweep.
+ * At most IP_FRAG_CLOCK_STEPS used entries are checked, if all of them
+ * were hit, the first one is chosen. Empty entries are skipped for no
+ * more than one pass.
+ */
+static struct ip_frag_pkt *
+ip_frag_tbl_clock(struct rte_ip_frag_tbl *tbl, const struct ip_frag_key *key)
+{
+	struct ip_frag_pkt *fp, *vp;
+	uint32_t i, n, steps;
+
+	vp = NULL;
+	n = 0;
+	steps = ip_frag_tbl_hand_steps(tbl);
+
+	for (i = 0; i != steps && n != IP_FRAG_CLOCK_STEPS; i++) {
+		fp = ip_frag_tbl_hand(tbl);
+		if (ip_frag_key_is_empty(&fp->key) ||
+				ip_frag_key_cmp(&fp->key, key) == 0)
+			continue;
+		if (fp->ref == 0)
+			return fp;
+		fp->ref = 0;
+		if (vp == NULL)
+			vp = fp;
+		n++;
+	}
+
+	return vp;
+}
+
+/* choose entry to evict by policy, entry with the given key is never chosen */
+static struct ip_frag_pkt *
+ip_frag_tbl_victim(struct rte_ip_frag_tbl *tbl, uint32_t policy,
+	const struct ip_frag_key *key, uint64_t tms)
+{
+	struct ip_frag_pkt *fp, *vp;
+	uint32_t n;
+#ifdef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	uint32_t i, steps;
+#endif
+
+	if (policy == RTE_IP_FRAG_EVICT_CLOCK)
+		return ip_frag_tbl_clock(tbl, key);
+
+	vp = NULL;
+	n = 0;
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	TAILQ_FOREACH(fp, &tbl->lru, lru) {
+		if (ip_frag_key_cmp(&fp->key, key) == 0)
+			continue;
+		if (vp == NULL ||
+				ip_frag_evict_before(tbl, policy, fp, vp, tms))
+			vp = fp;
+		if (policy == RTE_IP_FRAG_EVICT_OLDEST ||
+				policy == RTE_IP_FRAG_EVICT_EXPIRED ||
+				++n == IP_FRAG_EVICT_SAMPLE)
+			break;
+	}
 #else
+	/* no LRU order, sample entries from the CLOCK hand, at most one pass. */
+	steps = ip_frag_tbl_hand_steps(tbl);
+	for (i = 0; i != steps && n != IP_FRAG_EVICT_SAMPLE; i++) {
+		fp = ip_frag_tbl_hand(tbl);
+		if (ip_frag_key_is_empty(&fp->key) ||
+				ip_frag_key_cmp(&fp->key, key) == 0)
+			continue;
+		if (vp == NULL ||
+				ip_frag_evict_before(tbl, policy, fp, vp, tms))
+			vp = fp;
+		n++;
+	}
+#endif
+
+	/* by default, only entries with expired TTL are evicted. */
+	if (policy == RTE_IP_FRAG_EVICT_EXPIRED && vp != NULL &&
+			!ip_frag_expired(tbl, vp, tms))
+		return NULL;
+
+	return vp;
+}
+
+/*
+ * Evict other datagrams by policy, until one more fragment of len bytes
+ * fits into table budget. Entry with the given key is never evicted.
+ */
+static inline int
+ip_frag_tbl_evict(struct rte_ip_frag_tbl *tbl,
+	struct rte_ip_frag_death_row *dr, const struct ip_frag_key *key,
+	uint16_t len, uint64_t tms)
+{
+	struct ip_frag_pkt *vp;
+
+	while (tbl->mem.bytes + len > tbl->mem.max_bytes ||
+			tbl->mem.mbufs >= tbl->mem.max_mbufs) {
+
+		/* leave room on death row for the fragment being processed. */
+		if (dr->cnt + IP_FRAG_DR_RESERVE > RTE_DIM(dr->row))
+			return -ENOSPC;
 
-	v = rte_jhash_3words(p[0], p[1], p[2], PRIME_VALUE);
-	v = rte_jhash_3words(p[3], p[4], p[5], v);
-	v = rte_jhash_3words(p[6], p[7], key->id, v);
-#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+		if ((vp = ip_frag_tbl_victim(tbl, tbl->mem.policy, key,
+				tms)) == NULL)
+			return -ENOBUFS;
 
-	*v1 =  v;
-	*v2 = (v << 7) + (v >> 14);
+		ip_frag_tbl_del(tbl, dr, vp);
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, evict_num, 1);
+	}
+
+	return 0;
 }
 
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
 void 
 ip_frag_tbl_check_lru(struct rte_ip_frag_tbl *tbl, 
 		struct rte_ip_frag_death_row *dr, uint64_t tms)
@@ -161,38 +606,119 @@ ip_frag_tbl_check_lru(struct rte_ip_frag_tbl *tbl,
 		ip_frag_tbl_del(tbl, dr, lru);
 	}
 }
+#else
+/*
+ * check next bucket_entries entries, move expired ones to death row.
+ * While resize is in progress, not yet migrated part of the old array
+ * is swept too.
+ */
+void
+ip_frag_tbl_check_lru(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr, uint64_t tms)
+{
+	struct ip_frag_pkt *fp;
+	uint32_t i, steps;
 
+	if (dr == NULL)
+		return;
 
-struct rte_mbuf *
-ip_frag_process(struct ip_frag_pkt *fp, struct rte_ip_frag_death_row *dr,
-	struct rte_mbuf *mb, uint16_t ofs, uint16_t len, uint16_t more_frags)
+	steps = RTE_MIN(tbl->bucket_entries, ip_frag_tbl_hand_steps(tbl));
+
+	for (i = 0; i != steps; i++) {
+
+		/* leave the rest for the next call, if death row is full. */
+		if (dr->cnt + IP_MAX_FRAG_NUM > RTE_DIM(dr->row))
+			break;
+
+		fp = ip_frag_tbl_next(tbl, &tbl->sweep_pos);
+		if (!ip_frag_key_is_empty(&fp->key) &&
+				ip_frag_expired(tbl, fp, tms)) {
+			IP_FRAG_LOG(INFO, "%s:%d Move entry %p to death-row"
+				"(age %" PRIu64 " epochs)\n", __func__, __LINE__,
+				fp, ip_frag_age(tbl, fp, tms));
+
+			ip_frag_tbl_del(tbl, dr, fp);
+		}
+	}
+}
+#endif /* RTE_LIBRTE_IP_FRAG_EPOCH_AGING */
+
+/*
+ * copy mode: copy fragment payload at its offset into the datagram buffer,
+ * taken with the first fragment to arrive. Header of the first fragment
+ * goes into the headroom, right before the payload.
+ */
+static inline int
+ip_frag_copy(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	const struct rte_mbuf *mb, uint16_t ofs, uint16_t len)
 {
-	uint32_t idx;
+	struct rte_mbuf *m;
+	uint32_t hlen;
+
+	hlen = mb->l2_len + mb->l3_len;
+	if (mb->pkt_len < hlen + len)
+		return -EINVAL;
+
+	if ((m = fp->buf) == NULL) {
+		if ((m = rte_pktmbuf_alloc(tbl->copy_pool)) == NULL)
+			return -ENOBUFS;
+		fp->buf = m;
+		fp->nb_mbufs++;
+		tbl->mem.mbufs++;
+	}
 
-	fp->frag_size += len;
+	if (m->data_off + ofs + len > m->buf_len ||
+			(ofs == 0 && hlen > m->data_off))
+		return -EFBIG;
 
-	/* this is the first fragment. */
+	ip_frag_copy_data(rte_pktmbuf_mtod_offset(m, char *, ofs), mb, hlen,
+		len);
+
+	/* reassembled packet keeps header and metadata of the first one. */
 	if (ofs == 0) {
-		idx = (fp->frags[IP_FIRST_FRAG_IDX].mb == NULL) ?
-				IP_FIRST_FRAG_IDX : UINT32_MAX;
+		ip_frag_copy_data(rte_pktmbuf_mtod(m, char *) - hlen, mb, 0,
+			hlen);
+		m->l2_len = mb->l2_len;
+		m->l3_len = mb->l3_len;
+		m->port = mb->port;
+		m->ol_flags = mb->ol_flags;
+		m->packet_type = mb->packet_type;
+		m->vlan_tci = mb->vlan_tci;
+		m->hash = mb->hash;
+	}
 
-	/* this is the last fragment. */
-	} else if (more_frags == 0) {
-		fp->total_size = ofs + len;
-		idx = (fp->frags[IP_LAST_FRAG_IDX].mb == NULL) ?
-				IP_LAST_FRAG_IDX : UINT32_MAX;
+	return 0;
+}
 
-	/* this is the intermediate fragment. */
-	} else if ((idx = fp->last_idx) <
-		sizeof (fp->frags) / sizeof (fp->frags[0])) {
-		fp->last_idx++;
+/*
+ * reassemble the entry once all of its fragments are collected,
+ * invalidate it if the reassembly is done or failed.
+ */
+static struct rte_mbuf *
+ip_frag_complete(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	struct rte_ip_frag_death_row *dr)
+{
+	struct rte_mbuf *mb;
+
+	mb = NULL;
+
+	/* not all fragments are collected yet. */
+	if (likely (fp->frag_size < fp->total_size)) {
+		IP_FRAG_LOG(DEBUG, "Need more fragment\n");
+		return mb;
+
+	/* if we collected all fragments, then try to reassemble. */
+	} else if (fp->frag_size == fp->total_size &&
+			fp->frags[IP_FIRST_FRAG_IDX].mb != NULL) {
+		IP_FRAG_LOG(DEBUG, "Receive all fragments\n");
+		if (fp->key.key_len == IPV4_KEYLEN)
+			mb = ipv4_frag_reassemble(fp);
+		else
+			mb = ipv6_frag_reassemble(fp);
 	}
 
-	/*
-	 * errorneous packet: either exceeed max allowed number of fragments,
-	 * or duplicate first/last fragment encountered.
-	 */
-	if (idx >= sizeof (fp->frags) / sizeof (fp->frags[0])) {
+	/* errorenous set of fragments. */
+	if (mb == NULL) {
 
 		/* report an error. */
 		if (fp->key.key_len == IPV4_KEYLEN)
@@ -222,37 +748,123 @@ ip_frag_process(struct ip_frag_pkt *fp, struct rte_ip_frag_death_row *dr,
 				fp->frags[IP_LAST_FRAG_IDX].ofs,
 				fp->frags[IP_LAST_FRAG_IDX].len);
 
-		/* free all fragments, invalidate the entry. */
-		ip_frag_free(fp, dr);
-		ip_frag_key_invalidate(&fp->key);
-		IP_FRAG_MBUF2DR(dr, mb);
+		/* free associated resources. */
+		ip_frag_free(tbl, fp, dr);
+		ip_frag_quota_update(tbl, &fp->key, -1, 0);
+	} else {
+		ip_frag_ext_put(tbl, fp);
+		ip_frag_mem_put(tbl, fp);
+		ip_frag_quota_update(tbl, &fp->key, -1,
+			-(int32_t)fp->frag_size);
+	}
 
-		return NULL;
+	/* we are done with that entry, invalidate it. */
+	ip_frag_cache_del(tbl, fp);
+	ip_frag_tomb_add(tbl, &fp->key);
+	ip_frag_key_invalidate(&fp->key);
+	return mb;
+}
+
+/*
+ * absorb: copy payload of a tiny fragment into tailroom of the fragment
+ * ending right where it starts, so it takes neither a slot nor a link
+ * in the reassembled chain. That fragment's data has to end with its
+ * payload, in a segment nobody else refers to.
+ */
+static inline int
+ip_frag_absorb(struct ip_frag_pkt *fp, const struct rte_mbuf *mb,
+	uint16_t ofs, uint16_t len)
+{
+	struct ip_frag *frag;
+	struct rte_mbuf *ms;
+	uint32_t flen, hlen, i;
+
+	hlen = mb->l2_len + mb->l3_len;
+	if (mb->pkt_len < hlen + len)
+		return -EINVAL;
+
+	for (i = 0; i != fp->last_idx; i++) {
+
+		frag = ip_frag_slot(fp, i);
+		if (frag->mb == NULL || frag->ofs + frag->len != ofs)
+			continue;
+
+		ms = frag->tail;
+		flen = frag->mb->l2_len + frag->mb->l3_len;
+		if (frag->mb->pkt_len != flen + frag->len ||
+				RTE_MBUF_INDIRECT(ms) ||
+				rte_mbuf_refcnt_read(frag->mb) != 1 ||
+				rte_mbuf_refcnt_read(ms) != 1 ||
+				rte_pktmbuf_tailroom(ms) < len)
+			return -ENOSPC;
+
+		ip_frag_copy_data(rte_pktmbuf_mtod_offset(ms, char *,
+			ms->data_len), mb, hlen, len);
+		ms->data_len += len;
+		frag->mb->pkt_len += len;
+		frag->len += len;
+		return 0;
 	}
 
-	fp->frags[idx].ofs = ofs;
-	fp->frags[idx].len = len;
-	fp->frags[idx].mb = mb;
+	return -ENOENT;
+}
 
-	mb = NULL;
+struct rte_mbuf *
+ip_frag_process(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb, uint16_t ofs,
+	uint16_t len, uint16_t more_frags)
+{
+	struct ip_frag *frag;
+	uint32_t idx;
 
-	/* not all fragments are collected yet. */
-	if (likely (fp->frag_size < fp->total_size)) {
-		IP_FRAG_LOG(DEBUG, "Need more fragment\n");
-		return mb;
+	fp->frag_size += len;
+	tbl->mem.bytes += len;
 
-	/* if we collected all fragments, then try to reassemble. */
-	} else if (fp->frag_size == fp->total_size &&
-			fp->frags[IP_FIRST_FRAG_IDX].mb != NULL) {
-		IP_FRAG_LOG(DEBUG, "Receive all fragments\n");
-		if (fp->key.key_len == IPV4_KEYLEN)
-			mb = ipv4_frag_reassemble(fp);
-		else
-			mb = ipv6_frag_reassemble(fp);
+	/* tiny intermediate fragment, try to append it to the previous one. */
+	if (unlikely(len <= tbl->absorb_len) && ofs != 0 && more_frags != 0 &&
+			tbl->copy_pool == NULL &&
+			ip_frag_absorb(fp, mb, ofs, len) == 0) {
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, absorb_num, 1);
+		IP_FRAG_MBUF2DR(dr, mb);
+		return ip_frag_complete(tbl, fp, dr);
 	}
 
-	/* errorenous set of fragments. */
-	if (mb == NULL) {
+	/* this is the first fragment. */
+	if (ofs == 0) {
+		idx = (fp->frags[IP_FIRST_FRAG_IDX].mb == NULL) ?
+				IP_FIRST_FRAG_IDX : UINT32_MAX;
+
+	/* this is the last fragment. */
+	} else if (more_frags == 0) {
+		fp->total_size = ofs + len;
+		idx = (fp->frags[IP_LAST_FRAG_IDX].mb == NULL) ?
+				IP_LAST_FRAG_IDX : UINT32_MAX;
+
+	/* this is the intermediate fragment. */
+	} else if ((idx = fp->last_idx) < IP_MAX_FRAG_NUM) {
+
+		/* take next overflow block from the slab, if needed. */
+		if (ip_frag_ext_grow(tbl, fp, idx) == 0)
+			fp->last_idx++;
+		else {
+			idx = UINT32_MAX;
+			IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_noslot, 1);
+		}
+	}
+
+	/* in copy mode, fragment data goes to the datagram buffer now. */
+	if (tbl->copy_pool != NULL && idx < IP_MAX_FRAG_NUM &&
+			ip_frag_copy(tbl, fp, mb, ofs, len) != 0) {
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_copy, 1);
+		idx = UINT32_MAX;
+	}
+
+	/*
+	 * errorneous packet: either exceeed max allowed number of fragments,
+	 * run out of overflow slots, fragment didn't fit copy buffer,
+	 * or duplicate first/last fragment encountered.
+	 */
+	if (idx >= IP_MAX_FRAG_NUM) {
 
 		/* report an error. */
 		if (fp->key.key_len == IPV4_KEYLEN)
@@ -282,27 +894,497 @@ ip_frag_process(struct ip_frag_pkt *fp, struct rte_ip_frag_death_row *dr,
 				fp->frags[IP_LAST_FRAG_IDX].ofs,
 				fp->frags[IP_LAST_FRAG_IDX].len);
 
-		/* free associated resources. */
-		ip_frag_free(fp, dr);
+		/* free all fragments, invalidate the entry. */
+		ip_frag_free(tbl, fp, dr);
+		ip_frag_quota_update(tbl, &fp->key, -1, 0);
+		ip_frag_cache_del(tbl, fp);
+		ip_frag_tomb_add(tbl, &fp->key);
+		ip_frag_key_invalidate(&fp->key);
+		IP_FRAG_MBUF2DR(dr, mb);
+
+		return NULL;
 	}
 
-	/* we are done with that entry, invalidate it. */
+	frag = ip_frag_slot(fp, idx);
+	frag->ofs = ofs;
+	frag->len = len;
+
+	if (tbl->copy_pool != NULL) {
+		frag->mb = fp->buf;
+		frag->tail = NULL;
+		IP_FRAG_MBUF2DR(dr, mb);
+	} else {
+		frag->mb = mb;
+		frag->tail = rte_pktmbuf_lastseg(mb);
+		fp->nb_mbufs += mb->nb_segs;
+		tbl->mem.mbufs += mb->nb_segs;
+	}
+
+	return ip_frag_complete(tbl, fp, dr);
+}
+
+/* flow of the forwarded datagram is known, L4 ports are in low 32 bits */
+#define	IP_FRAG_FLOW_KNOWN	(1ULL << 32)
+
+/*
+ * Record byte range of a fragment that is passed through, or kept if keep
+ * is set, while the datagram isn't built. Returns 0 and the slot taken,
+ * 1 if all of the range was seen already, negative errno if the range
+ * overlaps a seen one only in part or no slot is left. Ranges of passed
+ * fragments are merged with the ones they touch, so that fragments
+ * in order take one slot. Kept fragments leave room for the first one,
+ * to be returned along with them.
+ */
+static inline int
+ip_frag_range_add(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	uint16_t ofs, uint16_t len, uint32_t keep, struct ip_frag **slot)
+{
+	struct ip_frag *frag, *free, *prev, *next;
+	uint32_t i, n, end;
+
+	end = ofs + len;
+	free = NULL;
+	prev = NULL;
+	next = NULL;
+	n = 0;
+
+	for (i = 0; i != fp->last_idx; i++) {
+		frag = ip_frag_slot(fp, i);
+		n += (frag->mb != NULL);
+		if (frag->len == 0) {
+			if (free == NULL && frag->mb == NULL)
+				free = frag;
+		} else if (ofs >= frag->ofs && end <= frag->ofs + frag->len)
+			return 1;
+		else if (ofs < frag->ofs + frag->len && end > frag->ofs)
+			return -EINVAL;
+		else if (frag->mb == NULL && frag->ofs + frag->len == ofs)
+			prev = frag;
+		else if (frag->mb == NULL && frag->ofs == end)
+			next = frag;
+	}
+
+	/* fill the gap between two ranges, or extend one of them. */
+	if (keep == 0 && prev != NULL) {
+		prev->len = (uint16_t)(prev->len + len);
+		if (next != NULL) {
+			prev->len = (uint16_t)(prev->len + next->len);
+			next->len = 0;
+		}
+		*slot = prev;
+		return 0;
+	} else if (keep == 0 && next != NULL) {
+		next->ofs = ofs;
+		next->len = (uint16_t)(next->len + len);
+		*slot = next;
+		return 0;
+	}
+
+	if (keep != 0 && n >= IP_MAX_FRAG_NUM - 1) {
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_noslot, 1);
+		return -ENOSPC;
+	}
+
+	if (free == NULL) {
+		i = fp->last_idx;
+		if (i >= IP_MAX_FRAG_NUM || ip_frag_ext_grow(tbl, fp, i) != 0) {
+			IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_noslot, 1);
+			return -ENOSPC;
+		}
+		fp->last_idx++;
+		free = ip_frag_slot(fp, i);
+	}
+
+	free->ofs = ofs;
+	free->len = len;
+	free->mb = NULL;
+	free->tail = NULL;
+	*slot = free;
+	return 0;
+}
+
+/* bytes of the datagram covered by the recorded ranges */
+static inline uint32_t
+ip_frag_range_size(struct ip_frag_pkt *fp)
+{
+	uint32_t i, n;
+
+	n = 0;
+	for (i = 0; i != fp->last_idx; i++)
+		n += ip_frag_slot(fp, i)->len;
+	return n;
+}
+
+/* drop forwarded datagram, along with fragments waiting for its flow */
+static inline void
+ip_frag_forward_drop(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb)
+{
+	IP_FRAG_LOG(DEBUG, "%s:%d invalid fragmented packet: %p, "
+		"total_size: %u, frag_size: %u, last_idx: %u\n",
+		__func__, __LINE__, fp, fp->total_size, fp->frag_size,
+		fp->last_idx);
+
+	ip_frag_free(tbl, fp, dr);
+	ip_frag_quota_update(tbl, &fp->key, -1, 0);
+	ip_frag_cache_del(tbl, fp);
+	ip_frag_tomb_add(tbl, &fp->key);
 	ip_frag_key_invalidate(&fp->key);
-	return mb;
+	IP_FRAG_MBUF2DR(dr, mb);
+}
+
+/*
+ * Virtual reassembly: once the first fragment brought the L4 flow of the
+ * datagram, its fragments are forwarded as they come, tagged with the flow
+ * in hash.usr. Fragments ahead of the first one wait in the entry slots,
+ * only they are counted in frag_size, table memory and source quota.
+ * Slots keep byte ranges of the fragments seen, duplicates are dropped
+ * and partial overlaps drop the datagram. A fragment passed through with
+ * no slot left to record it isn't counted, so the entry lives out its ttl.
+ * The entry is done, when the last fragment came and all bytes of the
+ * datagram passed through.
+ * Returns number of fragments stored into out.
+ */
+uint32_t
+ip_frag_forward(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb, uint16_t ofs,
+	uint16_t len, uint16_t more_frags, struct rte_mbuf **out)
+{
+	struct ip_frag *frag;
+	uint32_t i, n, flow, hlen, keep;
+	int ret;
+
+	keep = (fp->flow == 0 && ofs != 0);
+	ret = ip_frag_range_add(tbl, fp, ofs, len, keep, &frag);
+
+	/* all of it passed through already, or waits for the first one. */
+	if (ret > 0) {
+		IP_FRAG_MBUF2DR(dr, mb);
+		return 0;
+	}
+
+	/* only fragments waiting for the first one take table memory. */
+	if (keep != 0) {
+		fp->frag_size += len;
+		tbl->mem.bytes += len;
+	}
+
+	/* one last fragment only, nothing beyond it. */
+	if (ret == 0 && ((more_frags == 0 && fp->total_size != UINT32_MAX) ||
+			(uint32_t)ofs + len > fp->total_size))
+		ret = -EINVAL;
+
+	/* with no slot to record it, pass it through, entry waits for ttl. */
+	if (ret < 0 && (ret != -ENOSPC || keep != 0)) {
+		ip_frag_forward_drop(tbl, fp, dr, mb);
+		return 0;
+	}
+
+	if (ret == 0 && more_frags == 0)
+		fp->total_size = ofs + len;
+
+	n = 0;
+	hlen = mb->l2_len + mb->l3_len;
+
+	/* flow is known, pass the fragment through. */
+	if (fp->flow != 0) {
+		mb->hash.usr = (uint32_t)fp->flow;
+		out[n++] = mb;
+
+	/* wait for the first fragment. */
+	} else if (ofs != 0) {
+		frag->mb = mb;
+		fp->nb_mbufs += mb->nb_segs;
+		tbl->mem.mbufs += mb->nb_segs;
+
+	/* first fragment should hold the ports. */
+	} else if (len < sizeof(flow) || mb->pkt_len < hlen + sizeof(flow)) {
+		ip_frag_forward_drop(tbl, fp, dr, mb);
+		return 0;
+
+	/* take the flow and release fragments that waited for it. */
+	} else {
+		ip_frag_copy_data((char *)&flow, mb, hlen, sizeof(flow));
+		fp->flow = IP_FRAG_FLOW_KNOWN | flow;
+
+		mb->hash.usr = flow;
+		out[n++] = mb;
+		for (i = 0; i != fp->last_idx; i++) {
+			frag = ip_frag_slot(fp, i);
+			if (frag->mb != NULL) {
+				frag->mb->hash.usr = flow;
+				out[n++] = frag->mb;
+				frag->mb = NULL;
+			}
+		}
+
+		ip_frag_mem_put(tbl, fp);
+		ip_frag_quota_update(tbl, &fp->key, 0, -(int32_t)fp->frag_size);
+		fp->frag_size = 0;
+	}
+
+	/* all of the datagram passed through, nothing is held any more. */
+	if (fp->flow != 0 && fp->total_size == ip_frag_range_size(fp)) {
+		ip_frag_ext_put(tbl, fp);
+		ip_frag_quota_update(tbl, &fp->key, -1, 0);
+		ip_frag_cache_del(tbl, fp);
+		ip_frag_tomb_add(tbl, &fp->key);
+		ip_frag_key_invalidate(&fp->key);
+	}
+
+	return n;
+}
+
+/*
+ * Fragment flow classification: the first fragment records L4 ports of the
+ * datagram, like ip_frag_forward() does, but the table holds no mbufs,
+ * so nothing is counted in frag_size, table memory or source quota bytes.
+ * Fragments of a datagram with known flow get the flow hash in hash.rss and
+ * PKT_RX_RSS_HASH set, others get that flag cleared. Slots keep byte ranges
+ * seen, so duplicates are not counted, and a partial overlap ends the entry.
+ * Fragments with no slot left to record them aren't counted either.
+ * The entry is done, when the last fragment came and all bytes of the
+ * datagram were seen. Returns 1 if mbuf was tagged.
+ */
+uint32_t
+ip_frag_flow(struct rte_ip_frag_tbl *tbl, struct ip_frag_pkt *fp,
+	struct rte_mbuf *mb, uint16_t ofs, uint16_t len, uint16_t more_frags,
+	uint32_t proto)
+{
+	struct ip_frag *frag;
+	uint32_t flow, hlen;
+	int ret;
+
+	ret = ip_frag_range_add(tbl, fp, ofs, len, 0, &frag);
+
+	/* one last fragment only, nothing beyond it. */
+	if (ret == 0 && ((more_frags == 0 && fp->total_size != UINT32_MAX) ||
+			(uint32_t)ofs + len > fp->total_size))
+		ret = -EINVAL;
+
+	if (ret == -EINVAL) {
+		IP_FRAG_LOG(DEBUG, "%s:%d invalid fragmented packet: %p, "
+			"total_size: %u, frag_size: %u, last_idx: %u\n",
+			__func__, __LINE__, fp, fp->total_size, fp->frag_size,
+			fp->last_idx);
+
+		ip_frag_ext_put(tbl, fp);
+		ip_frag_quota_update(tbl, &fp->key, -1, 0);
+		ip_frag_cache_del(tbl, fp);
+		ip_frag_tomb_add(tbl, &fp->key);
+		ip_frag_key_invalidate(&fp->key);
+		mb->ol_flags &= ~PKT_RX_RSS_HASH;
+		return 0;
+	}
+
+	if (ret == 0 && more_frags == 0)
+		fp->total_size = ofs + len;
+
+	/* first fragment should hold the ports. */
+	hlen = mb->l2_len + mb->l3_len;
+	if (ofs == 0 && fp->flow == 0 && len >= sizeof(flow) &&
+			mb->pkt_len >= hlen + sizeof(flow)) {
+		ip_frag_copy_data((char *)&flow, mb, hlen, sizeof(flow));
+		fp->flow = IP_FRAG_FLOW_KNOWN | flow;
+	}
+
+	if (fp->flow == 0) {
+		mb->ol_flags &= ~PKT_RX_RSS_HASH;
+		return 0;
+	}
+
+	mb->hash.rss = ip_frag_flow_hash(&fp->key, proto, (uint32_t)fp->flow);
+	mb->ol_flags |= PKT_RX_RSS_HASH;
+
+	/* all of the datagram was seen. */
+	if (ret == 0 && fp->total_size == ip_frag_range_size(fp)) {
+		ip_frag_ext_put(tbl, fp);
+		ip_frag_quota_update(tbl, &fp->key, -1, 0);
+		ip_frag_cache_del(tbl, fp);
+		ip_frag_tomb_add(tbl, &fp->key);
+		ip_frag_key_invalidate(&fp->key);
+	}
+
+	return 1;
+}
+
+
+/*
+ * Complete datagrams, whose fragments all came within one burst, without
+ * adding them to the table. Fragments of each datagram are linked in
+ * arrival order, the reassembled packet takes the place of the last one
+ * and others are set to NULL. Taken fragments are marked done, the rest
+ * (incomplete datagrams, overlaps, keys already in the table) are left
+ * for the table.
+ */
+uint32_t
+ip_frag_burst_reassemble(struct rte_ip_frag_tbl *tbl, struct rte_mbuf **mb,
+	const struct ip_frag_key *key, const uint32_t *sig1, const uint32_t *sig2,
+	struct ip_frag_desc *fd, uint32_t num, uint64_t tms)
+{
+	struct ip_frag_pkt fp, *free, *stale;
+	struct ip_frag *frag;
+	uint32_t i, j, k, m, nb_out, sig[IP_FRAG_HASH_FNUM];
+	uint32_t head[IP_FRAG_HASH_BURST], next[IP_FRAG_HASH_BURST];
+	uint32_t tail[IP_FRAG_HASH_BURST], cnt[IP_FRAG_HASH_BURST];
+	uint32_t idx[IP_FRAG_INLINE_NUM];
+
+	/*
+	 * table keeps datagrams of one address family only,
+	 * in copy mode all of them are reassembled through the table.
+	 */
+	if (num < IP_MIN_FRAG_NUM || tbl->copy_pool != NULL ||
+			(tbl->key_len != 0 && tbl->key_len != key[0].key_len))
+		return 0;
+
+	/* group fragments by key, first fragment of each group heads it. */
+	for (i = 0; i != num; i++) {
+		head[i] = i;
+		tail[i] = i;
+		next[i] = UINT32_MAX;
+		cnt[i] = 1;
+
+		for (j = i; j-- != 0; ) {
+			if (head[j] == j && sig1[j] == sig1[i] &&
+					ip_frag_key_cmp(key + j, key + i) == 0) {
+				head[i] = j;
+				next[tail[j]] = i;
+				tail[j] = i;
+				cnt[j]++;
+				break;
+			}
+		}
+	}
+
+	nb_out = 0;
+	for (i = 0; i != num; i++) {
+		if (head[i] != i || cnt[i] < IP_MIN_FRAG_NUM ||
+				cnt[i] > IP_FRAG_INLINE_NUM)
+			continue;
+
+		/* sort fragments by offset. */
+		m = 0;
+		for (j = i; j != UINT32_MAX; j = next[j]) {
+			for (k = m++; k != 0 && fd[idx[k - 1]].ofs > fd[j].ofs; k--)
+				idx[k] = idx[k - 1];
+			idx[k] = j;
+		}
+
+		/* fragments should cover the datagram with no holes/overlaps. */
+		if (fd[idx[0]].ofs != 0 || fd[idx[m - 1]].more_frags != 0)
+			continue;
+		for (k = 1; k != m; k++) {
+			if (fd[idx[k - 1]].more_frags == 0 ||
+					fd[idx[k - 1]].ofs + fd[idx[k - 1]].len !=
+					fd[idx[k]].ofs)
+				break;
+		}
+		if (k != m)
+			continue;
+
+		/*
+		 * the table has fragments of that datagram already,
+		 * or it is done with the datagram.
+		 */
+		sig[0] = sig1[i];
+		sig[1] = sig2[i];
+		if (ip_frag_lookup(tbl, key + i, sig, tms, &free, &stale) != NULL ||
+				(unlikely(tbl->tomb.bits != NULL) &&
+				ip_frag_tomb_test(tbl, sig1[i], sig2[i]) != 0))
+			continue;
+
+		/* first, last, then intermediate fragments, as in the table. */
+		fp.key = key[i];
+		fp.ext = NULL;
+		fp.buf = NULL;
+		fp.last_idx = IP_MIN_FRAG_NUM + m - 2;
+		fp.total_size = fd[idx[m - 1]].ofs + fd[idx[m - 1]].len;
+		fp.frag_size = fp.total_size;
+		for (k = 0; k != m; k++) {
+			if (k == 0)
+				frag = fp.frags + IP_FIRST_FRAG_IDX;
+			else if (k == m - 1)
+				frag = fp.frags + IP_LAST_FRAG_IDX;
+			else
+				frag = fp.frags + IP_MIN_FRAG_NUM + k - 1;
+
+			frag->ofs = fd[idx[k]].ofs;
+			frag->len = fd[idx[k]].len;
+			frag->mb = mb[idx[k]];
+			frag->tail = rte_pktmbuf_lastseg(frag->mb);
+			ip_frag_socket_check(tbl, frag->mb);
+		}
+
+		/* no holes, so reassembly can't fail. */
+		for (j = i; j != tail[i]; j = next[j]) {
+			mb[j] = NULL;
+			fd[j].done = 1;
+		}
+		fd[j].done = 1;
+		mb[j] = (fp.key.key_len == IPV4_KEYLEN) ?
+			ipv4_frag_reassemble(&fp) : ipv6_frag_reassemble(&fp);
+
+		if (unlikely(tbl->tomb.bits != NULL))
+			ip_frag_tomb_set(tbl, sig1[i], sig2[i]);
+
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, burst_num, 1);
+		nb_out++;
+	}
+
+	return nb_out;
 }
 
+/* check if all of the range was seen by the entry already */
+static inline int
+ip_frag_range_seen(struct ip_frag_pkt *fp, uint16_t ofs, uint16_t len)
+{
+	struct ip_frag *frag;
+	uint32_t i;
+
+	for (i = 0; i != fp->last_idx; i++) {
+		frag = ip_frag_slot(fp, i);
+		if (frag->len != 0 && ofs >= frag->ofs &&
+				ofs + len <= frag->ofs + frag->len)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Check if the table is to keep the fragment of entry fp, NULL for a new
+ * entry. Forwarded datagrams keep fragments ahead of the first one, unless
+ * seen already, classified ones keep none.
+ */
+static inline uint32_t
+ip_frag_store(struct ip_frag_pkt *fp, uint32_t mode, uint16_t ofs,
+	uint16_t len)
+{
+	if (mode == IP_FRAG_FIND_REASSEMBLE)
+		return 1;
+
+	if (mode == IP_FRAG_FIND_FLOW || ofs == 0 ||
+			(fp != NULL && fp->flow != 0))
+		return 0;
+
+	return fp == NULL || !ip_frag_range_seen(fp, ofs, len);
+}
 
 /*
  * Find an entry in the table for the corresponding fragment.
  * If such entry is not present, then allocate a new one.
  * If the entry is stale, then free and reuse it.
+ * sig holds hash values of the key for both buckets, or NULL.
+ * mode tells what the caller keeps of fragments, only those kept are
+ * charged to the source quota and make room within the table budget.
  */
 struct ip_frag_pkt *
 ip_frag_find(struct rte_ip_frag_tbl *tbl, struct rte_ip_frag_death_row *dr,
-	const struct ip_frag_key *key, uint64_t tms)
+	const struct ip_frag_key *key, const uint32_t *sig, uint16_t ofs,
+	uint16_t len, uint32_t mode, uint64_t tms)
 {
-	struct ip_frag_pkt *pkt, *free, *stale, *lru;
-	uint64_t max_cycles;
+	struct ip_frag_pkt *pkt, *free, *stale, *victim;
+	uint32_t idx[IP_FRAG_QUOTA_ROWS], add, bytes, n, store;
 
 	/*
 	 * Actually the two line below are totally redundant.
@@ -310,11 +1392,55 @@ ip_frag_find(struct rte_ip_frag_tbl *tbl, struct rte_ip_frag_death_row *dr,
 	 */
 	free = NULL;
 	stale = NULL;
-	max_cycles = tbl->max_cycles;
 
 	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, find_num, 1);
 
-	if ((pkt = ip_frag_lookup(tbl, key, tms, &free, &stale)) == NULL) {
+	/* table keeps datagrams of one address family only. */
+	if (unlikely(tbl->key_len != 0 && tbl->key_len != key->key_len)) {
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_total, 1);
+		return NULL;
+	}
+
+	if (unlikely(tbl->resize.step != 0))
+		ip_frag_tbl_resize(tbl, dr);
+
+	pkt = ip_frag_lookup(tbl, key, sig, tms, &free, &stale);
+	add = (pkt == NULL);
+
+	/* expired entry is reused, as if it was a new one. */
+	store = ip_frag_store((pkt != NULL && !ip_frag_expired(tbl, pkt, tms)) ?
+		pkt : NULL, mode, ofs, len);
+	bytes = (store != 0) ? len : 0;
+
+	/* don't start a new entry for a datagram the table is done with. */
+	if (unlikely(tbl->tomb.bits != NULL)) {
+		ip_frag_tomb_age(tbl, tms);
+		if (add != 0 && ip_frag_tomb_find(tbl, key, sig) != 0) {
+			IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, tomb_drop, 1);
+			return NULL;
+		}
+	}
+
+	/* don't let a single source take over the table. */
+	if (unlikely(tbl->quota.cnt != NULL) &&
+			ip_frag_quota_check(tbl, key, add, bytes, idx) != 0)
+		return NULL;
+
+	/* make room for the fragment, if table is over its memory budget. */
+	if (store != 0 && unlikely(tbl->mem.bytes + len > tbl->mem.max_bytes ||
+			tbl->mem.mbufs >= tbl->mem.max_mbufs)) {
+		n = tbl->use_entries;
+		if (ip_frag_tbl_evict(tbl, dr, key, len, tms) != 0) {
+			IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_budget, 1);
+			return NULL;
+		}
+
+		/* evicted entries could leave a place in the key's buckets. */
+		if (pkt == NULL && n != tbl->use_entries)
+			ip_frag_lookup(tbl, key, sig, tms, &free, &stale);
+	}
+
+	if (pkt == NULL) {
 
 		/*timed-out entry, free and invalidate it*/
 		if (stale != NULL) {
@@ -324,13 +1450,16 @@ ip_frag_find(struct rte_ip_frag_tbl *tbl, struct rte_ip_frag_death_row *dr,
 		/*
 		 * we found a free entry, check if we can use it.
 		 * If we run out of free entries in the table, then
-		 * check if we have a timed out entry to delete.
+		 * check if we have an entry to evict by table policy.
 		 */
 		} else if (free != NULL &&
 				tbl->max_entries <= tbl->use_entries) {
-			lru = TAILQ_FIRST(&tbl->lru);
-			if (max_cycles + lru->start < tms) {
-				ip_frag_tbl_del(tbl, dr, lru);
+			victim = ip_frag_tbl_victim(tbl, tbl->evict_policy,
+				key, tms);
+			if (victim != NULL) {
+				IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, evict_full,
+					!ip_frag_expired(tbl, victim, tms));
+				ip_frag_tbl_del(tbl, dr, victim);
 			} else {
 				free = NULL;
 				IP_FRAG_TBL_STAT_UPDATE(&tbl->stat,
@@ -349,107 +1478,102 @@ ip_frag_find(struct rte_ip_frag_tbl *tbl, struct rte_ip_frag_death_row *dr,
 	 * so free associated resources, reposition it in the LRU list,
 	 * and reuse it.
 	 */
-	} else if (max_cycles + pkt->start < tms) {
+	} else if (ip_frag_expired(tbl, pkt, tms)) {
 		ip_frag_tbl_reuse(tbl, dr, pkt, tms);
-	}
+
+	/* give the entry a second chance on CLOCK sweep. */
+	} else
+		pkt->ref = 1;
+
+	if (unlikely(tbl->quota.cnt != NULL) && pkt != NULL)
+		ip_frag_quota_add(tbl, idx, add, bytes);
 
 	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, fail_total, (pkt == NULL));
 
 	/* now mbuf is in frag_tbl */
 	IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, mbuf_num, (pkt != NULL));
 
-	tbl->last = pkt;
+	if (pkt != NULL)
+		tbl->cache[ip_frag_cache_idx(key)] = pkt;
 	return pkt;
 }
 
-struct ip_frag_pkt *
-ip_frag_lookup(struct rte_ip_frag_tbl *tbl,
-	const struct ip_frag_key *key, uint64_t tms,
-	struct ip_frag_pkt **free, struct ip_frag_pkt **stale)
+static __ip_frag_always_inline struct ip_frag_pkt *
+ip_frag_lookup_len(struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *key, const uint32_t *sig, uint64_t tms,
+	struct ip_frag_pkt **free, struct ip_frag_pkt **stale,
+	const uint32_t len)
 {
-	struct ip_frag_pkt *p1, *p2;
+	struct ip_frag_pkt *p1, *p2, *pkt;
 	struct ip_frag_pkt *empty, *old;
-	uint64_t max_cycles;
+	uint64_t deadline;
 	uint32_t i, assoc, sig1, sig2;
 
 	empty = NULL;
 	old = NULL;
 
-	max_cycles = tbl->max_cycles;
+	deadline = ip_frag_deadline(tbl, tms);
 	assoc = tbl->bucket_entries;
 
-	if (tbl->last != NULL && ip_frag_key_cmp(key, &tbl->last->key) == 0)
-		return tbl->last;
+	/* recently used entries are checked before hashing. */
+	pkt = tbl->cache[ip_frag_cache_idx(key)];
+	if (pkt != NULL && ip_frag_key_cmp_len(key, &pkt->key, len) == 0) {
+		IP_FRAG_TBL_STAT_UPDATE(&tbl->stat, cache_hit, 1);
+		return pkt;
+	}
 
-	/* different hashing methods for IPv4 and IPv6 */
-	if (key->key_len == IPV4_KEYLEN)
-		ipv4_frag_hash(key, &sig1, &sig2);
-	else
-		ipv6_frag_hash(key, &sig1, &sig2);
+	/* the key could be hashed already, along with its burst. */
+	if (sig != NULL) {
+		sig1 = sig[0];
+		sig2 = sig[1];
+	} else
+		ip_frag_hash_len(tbl, key, len, &sig1, &sig2);
 
 	p1 = IP_FRAG_TBL_POS(tbl, sig1);
 	p2 = IP_FRAG_TBL_POS(tbl, sig2);
 
-	IP_FRAG_LOG(DEBUG, "key->key_len %u (IPV4_KEYLEN %u)\n", key->key_len,
-			IPV4_KEYLEN);
-	IP_FRAG_LOG(DEBUG, "p1->key.key_len %u\n", p1->key.key_len);
-	IP_FRAG_LOG(DEBUG, "p2->key.key_len %u\n", p2->key.key_len);
-
 	for (i = 0; i != assoc; i++) {
-		if (p1->key.key_len == IPV4_KEYLEN)
-			IP_FRAG_LOG(DEBUG, "%s:%d:\n"
-					"tbl: %p, max_entries: %u, use_entries: %u\n"
-					"ipv4_frag_pkt line0: %p, index: %u from %u\n"
-			"key: <%" PRIx64 ", %#x>, start: %" PRIu64 "\n",
-					__func__, __LINE__,
-					tbl, tbl->max_entries, tbl->use_entries,
-					p1, i, assoc,
-			p1[i].key.src_dst[0], p1[i].key.id, p1[i].start);
-		else
-			IP_FRAG_LOG(DEBUG, "%s:%d:\n"
-					"tbl: %p, max_entries: %u, use_entries: %u\n"
-					"ipv6_frag_pkt line0: %p, index: %u from %u\n"
-			"key: <" IPv6_KEY_BYTES_FMT ", %#x>, start: %" PRIu64 "\n",
-					__func__, __LINE__,
-					tbl, tbl->max_entries, tbl->use_entries,
-					p1, i, assoc,
-			IPv6_KEY_BYTES(p1[i].key.src_dst), p1[i].key.id, p1[i].start);
-
-		if (ip_frag_key_cmp(key, &p1[i].key) == 0)
+		IP_FRAG_TRACE_ENTRY(tbl, 0, p1, i);
+		if (ip_frag_key_cmp_len(key, &p1[i].key, len) == 0)
 			return (p1 + i);
 		else if (ip_frag_key_is_empty(&p1[i].key))
 			empty = (empty == NULL) ? (p1 + i) : empty;
-		else if (max_cycles + p1[i].start < tms)
+		else if (ip_frag_expired_by(p1 + i, deadline))
 			old = (old == NULL) ? (p1 + i) : old;
 
-		if (p2->key.key_len == IPV4_KEYLEN)
-			IP_FRAG_LOG(DEBUG, "%s:%d:\n"
-					"tbl: %p, max_entries: %u, use_entries: %u\n"
-					"ipv4_frag_pkt line1: %p, index: %u from %u\n"
-			"key: <%" PRIx64 ", %#x>, start: %" PRIu64 "\n",
-					__func__, __LINE__,
-					tbl, tbl->max_entries, tbl->use_entries,
-					p2, i, assoc,
-			p2[i].key.src_dst[0], p2[i].key.id, p2[i].start);
-		else
-			IP_FRAG_LOG(DEBUG, "%s:%d:\n"
-					"tbl: %p, max_entries: %u, use_entries: %u\n"
-					"ipv6_frag_pkt line1: %p, index: %u from %u\n"
-			"key: <" IPv6_KEY_BYTES_FMT ", %#x>, start: %" PRIu64 "\n",
-					__func__, __LINE__,
-					tbl, tbl->max_entries, tbl->use_entries,
-					p2, i, assoc,
-			IPv6_KEY_BYTES(p2[i].key.src_dst), p2[i].key.id, p2[i].start);
-
-		if (ip_frag_key_cmp(key, &p2[i].key) == 0)
+		IP_FRAG_TRACE_ENTRY(tbl, 1, p2, i);
+		if (ip_frag_key_cmp_len(key, &p2[i].key, len) == 0)
 			return (p2 + i);
 		else if (ip_frag_key_is_empty(&p2[i].key))
 			empty = (empty == NULL) ?( p2 + i) : empty;
-		else if (max_cycles + p2[i].start < tms)
+		else if (ip_frag_expired_by(p2 + i, deadline))
 			old = (old == NULL) ? (p2 + i) : old;
 	}
 
+	/* new entries always go into the current array. */
+	if (unlikely(tbl->resize.old != NULL) &&
+			(p1 = ip_frag_lookup_old(tbl, key, sig1, sig2, len)) != NULL)
+		return p1;
+
 	*free = empty;
 	*stale = old;
 	return NULL;
 }
+
+/* lookup specialized by the address family of the table */
+struct ip_frag_pkt *
+ip_frag_lookup(struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *key, const uint32_t *sig, uint64_t tms,
+	struct ip_frag_pkt **free, struct ip_frag_pkt **stale)
+{
+	switch (tbl->key_len) {
+	case IPV4_KEYLEN:
+		return ip_frag_lookup_len(tbl, key, sig, tms, free, stale,
+			IPV4_KEYLEN);
+	case IPV6_KEYLEN:
+		return ip_frag_lookup_len(tbl, key, sig, tms, free, stale,
+			IPV6_KEYLEN);
+	default:
+		return ip_frag_lookup_len(tbl, key, sig, tms, free, stale, 0);
+	}
+}
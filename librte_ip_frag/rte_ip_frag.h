@@ -52,6 +52,9 @@ extern "C" {
 #include <rte_memory.h>
 #include <rte_ip.h>
 #include <rte_byteorder.h>
+#include <rte_branch_prediction.h>
+#include <rte_per_lcore.h>
+#include <rte_cycles.h>
 
 struct rte_mbuf;
 
@@ -63,34 +66,121 @@ enum {
 	/**< maximum number of fragments per packet */
 };
 
+/** number of fragment slots embedded into each table entry */
+#ifndef RTE_LIBRTE_IP_FRAG_INLINE_FRAG
+#define	IP_FRAG_INLINE_NUM	(RTE_LIBRTE_IP_FRAG_MAX_FRAG < 4 ? \
+	RTE_LIBRTE_IP_FRAG_MAX_FRAG : 4)
+#else
+#define	IP_FRAG_INLINE_NUM	RTE_LIBRTE_IP_FRAG_INLINE_FRAG
+#endif
+
+#if IP_FRAG_INLINE_NUM < 2 || IP_FRAG_INLINE_NUM > RTE_LIBRTE_IP_FRAG_MAX_FRAG
+#error "inline fragment slots should cover first and last fragments"
+#endif
+
+/** number of recently used entries cached per table, power of two */
+#ifndef RTE_LIBRTE_IP_FRAG_CACHE_SIZE
+#define	IP_FRAG_CACHE_SIZE	32
+#else
+#define	IP_FRAG_CACHE_SIZE	RTE_LIBRTE_IP_FRAG_CACHE_SIZE
+#endif
+
+#if IP_FRAG_CACHE_SIZE == 0 || (IP_FRAG_CACHE_SIZE & (IP_FRAG_CACHE_SIZE - 1))
+#error "lookup cache size should be power of two"
+#endif
+
+/** number of fragment slots in each overflow block */
+#define	IP_FRAG_EXT_NUM	4
+
+/** max number of overflow blocks used by one table entry */
+#define	IP_FRAG_EXT_BLOCKS	\
+	((IP_MAX_FRAG_NUM - IP_FRAG_INLINE_NUM + IP_FRAG_EXT_NUM - 1) / \
+	IP_FRAG_EXT_NUM)
+
 /** @internal fragmented mbuf */
 struct ip_frag {
 	uint16_t ofs;          /**< offset into the packet */
 	uint16_t len;          /**< length of fragment */
 	struct rte_mbuf *mb;   /**< fragment mbuf */
+	struct rte_mbuf *tail; /**< last segment of fragment mbuf */
+};
+
+/** @internal block of overflow fragment slots, allocated from table slab */
+struct ip_frag_ext {
+	struct ip_frag_ext *next;   /**< next block of entry or free list */
+	struct ip_frag frags[IP_FRAG_EXT_NUM]; /**< fragments */
 };
 
-/** @internal <src addr, dst_addr, id> to uniquely indetify fragmented datagram. */
+/*
+ * @internal <src addr, dst_addr, id> to uniquely indetify fragmented datagram.
+ * IPv4 key takes the first 16 bytes, IPv6 key all 40 of them, so that keys
+ * are compared with one or three 16-byte loads. key_len tells IPv4 keys
+ * from IPv6 ones and marks empty table entries, so any address is valid.
+ */
 struct ip_frag_key {
-	uint64_t src_dst[4];      /**< src address, first 8 bytes used for IPv4 */
-	uint32_t id;           /**< dst address */
-	uint32_t key_len;      /**< src/dst key length */
+	uint32_t id;           /**< packet id */
+	uint32_t key_len;      /**< src/dst key length, 0 - empty entry */
+	uint64_t src_dst[4];      /**< src/dst address, first 8 bytes used for IPv4 */
 };
 
+#define IPV4_KEYLEN 1          /**< key_len of IPv4 keys, in 8-byte words */
+#define IPV6_KEYLEN 4          /**< key_len of IPv6 keys, in 8-byte words */
+
 /*
  * @internal Fragmented packet to reassemble.
  * First two entries in the frags[] array are for the last and first fragments.
+ * Slots beyond IP_FRAG_INLINE_NUM live in overflow blocks taken
+ * from the table slab on demand.
+ * In copy mode fragments are copied into buf on arrival, and all used
+ * slots point to it. When forwarding fragments, flow holds L4 ports of
+ * the datagram once its first fragment arrived, and slots keep byte ranges
+ * seen so far, along with fragments ahead of the first one. Only those
+ * fragments are counted in frag_size then.
+ * With RTE_LIBRTE_IP_FRAG_EPOCH_AGING entries are not linked into
+ * the LRU list, start keeps a coarse 32-bit epoch, and expired entries
+ * are found by sweeping the table a bucket at a time.
  */
 struct ip_frag_pkt {
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
 	TAILQ_ENTRY(ip_frag_pkt) lru;   /**< LRU list */
+#endif
 	struct ip_frag_key key;           /**< fragmentation key */
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
 	uint64_t             start;       /**< creation timestamp */
+#else
+	uint32_t             start;       /**< creation epoch */
+#endif
 	uint32_t             total_size;  /**< expected reassembled size */
 	uint32_t             frag_size;   /**< size of fragments received */
-	uint32_t             last_idx;    /**< index of next entry to fill */
-	struct ip_frag       frags[IP_MAX_FRAG_NUM]; /**< fragments */
+	uint32_t             nb_mbufs;    /**< mbuf segments buffered */
+	uint16_t             last_idx;    /**< index of next entry to fill */
+	uint16_t             ref;         /**< CLOCK reference bit */
+	struct ip_frag_ext  *ext;         /**< overflow fragment slots */
+	union {
+		struct rte_mbuf *buf;     /**< datagram buffer in copy mode */
+		uint64_t         flow;    /**< L4 flow when forwarding, 0 - unknown */
+	};
+	struct ip_frag       frags[IP_FRAG_INLINE_NUM]; /**< fragments */
 } __rte_cache_aligned;
 
+/*
+ * @internal Get fragment slot by index.
+ * Slot should be below last_idx of the entry.
+ */
+static inline struct ip_frag *
+ip_frag_slot(struct ip_frag_pkt *fp, uint32_t idx)
+{
+	struct ip_frag_ext *ext;
+
+	if (likely(idx < IP_FRAG_INLINE_NUM))
+		return fp->frags + idx;
+
+	idx -= IP_FRAG_INLINE_NUM;
+	for (ext = fp->ext; idx >= IP_FRAG_EXT_NUM; idx -= IP_FRAG_EXT_NUM)
+		ext = ext->next;
+	return ext->frags + idx;
+}
+
 #define IP_FRAG_DEATH_ROW_LEN 32 /**< death row size (in packets) */
 
 /** mbuf death row (packets to be freed) */
@@ -111,8 +201,89 @@ struct ip_frag_tbl_stat {
 	uint64_t fail_total;    /**< total # of add failures. */
 	uint64_t fail_nospace;  /**< # of 'no space' add failures. */
 	uint64_t mbuf_num;		/**< # of mbufs in tbl */
+	uint64_t fail_noslot;   /**< # of datagrams dropped on empty slab. */
+	uint64_t xsocket_num;   /**< # of mbufs from other socket's pools. */
+	uint64_t grow_num;      /**< # of table grow ops. */
+	uint64_t shrink_num;    /**< # of table shrink ops. */
+	uint64_t mig_num;       /**< # of entries migrated on resize. */
+	uint64_t mig_drop;      /**< # of entries dropped on resize. */
+	uint64_t fail_quota;    /**< # of fragments over source quota. */
+	uint64_t evict_num;     /**< # of entries evicted to fit budget. */
+	uint64_t fail_budget;   /**< # of fragments dropped over budget. */
+	uint64_t evict_full;    /**< # of live entries evicted on full table. */
+	uint64_t cache_hit;     /**< # of lookups hit in recent entries. */
+	uint64_t burst_num;     /**< # of datagrams completed within a burst. */
+	uint64_t fail_copy;     /**< # of fragments not fitting copy buffers. */
+	uint64_t absorb_num;    /**< # of tiny fragments absorbed by neighbors. */
+	uint64_t tomb_drop;     /**< # of fragments of finished datagrams. */
 } __rte_cache_aligned;
 
+/** @internal online resize state */
+struct ip_frag_tbl_resize {
+	struct ip_frag_pkt *old;      /**< entries being migrated, or NULL. */
+	uint32_t old_mask;            /**< hash value mask of old entries. */
+	uint32_t old_nb_entries;      /**< size of old entries array. */
+	uint32_t pos;                 /**< next old entry to migrate. */
+	uint32_t step;                /**< buckets migrated per call, 0 - off. */
+	uint32_t min_entries;         /**< lower limit for nb_entries. */
+	uint32_t max_entries;         /**< upper limit for nb_entries. */
+	uint32_t grow_load;           /**< grow at that % of max_entries. */
+	uint32_t shrink_load;         /**< shrink at that % of max_entries. */
+	uint32_t grow_use;            /**< use_entries to start growing. */
+	uint32_t shrink_use;          /**< use_entries to start shrinking. */
+	uint32_t want;                /**< size asked for, 0 - none. */
+	uint32_t spare_nb_entries;    /**< size of spare entries array. */
+	struct ip_frag_pkt *spare;    /**< entries array to resize into. */
+	struct ip_frag_pkt *retired;  /**< migrated from, not freed yet. */
+	uint32_t retired_nb_entries;  /**< size of retired entries array. */
+};
+
+/* number of count-min rows, tracking per-source quotas */
+#define	IP_FRAG_QUOTA_ROWS	2
+
+/** @internal in-flight counters of a group of sources */
+struct ip_frag_src_cnt {
+	uint32_t pkts;                /**< datagrams in the table. */
+	uint32_t bytes;               /**< fragment bytes in the table. */
+};
+
+/** @internal per-source quota state */
+struct ip_frag_tbl_quota {
+	struct ip_frag_src_cnt *cnt;  /**< counter rows, NULL - no quotas. */
+	uint32_t mask;                /**< counter index mask within a row. */
+	uint32_t max_pkts;            /**< datagrams per source, 0 - no limit. */
+	uint32_t max_bytes;           /**< bytes per source, 0 - no limit. */
+};
+
+/** @internal filter of recently finished datagrams */
+struct ip_frag_tbl_tomb {
+	uint64_t *bits;               /**< two generations, NULL - no filter. */
+	uint32_t mask;                /**< bit index mask within a generation. */
+	uint32_t cur;                 /**< generation keys are added to. */
+	uint64_t start;               /**< when the current generation started. */
+	uint64_t period;              /**< cycles per generation. */
+};
+
+/** @internal buffered fragments accounting */
+struct ip_frag_tbl_mem {
+	uint64_t bytes;               /**< fragment payload bytes buffered. */
+	uint64_t max_bytes;           /**< budget for bytes. */
+	uint32_t mbufs;               /**< mbuf segments buffered. */
+	uint32_t max_mbufs;           /**< budget for mbuf segments. */
+	uint32_t policy;              /**< eviction policy, over budget. */
+};
+
+/* 32-bit key words hashed: two IPv6 addresses and fragment id */
+#define	IP_FRAG_HASH_WORDS	(2 * IPV6_KEYLEN + 1)
+
+/** @internal keyed hash state */
+struct ip_frag_tbl_hash {
+	uint32_t type;                /**< rte_ip_frag_hash_type. */
+	uint32_t seed[2];             /**< CRC32 and jhash seeds, per bucket. */
+	uint64_t mul[2][IP_FRAG_HASH_WORDS + 1];
+	/**< multiply-shift coefficients per bucket, the last one is added. */
+};
+
 /** fragmentation table */
 struct rte_ip_frag_tbl {
 	uint64_t             max_cycles;      /**< ttl for table entries. */
@@ -122,10 +293,32 @@ struct rte_ip_frag_tbl {
 	uint32_t             bucket_entries;  /**< hash assocaitivity. */
 	uint32_t             nb_entries;      /**< total size of the table. */
 	uint32_t             nb_buckets;      /**< num of associativity lines. */
-	struct ip_frag_pkt *last;         /**< last used entry. */
+	int                  socket_id;       /**< NUMA socket of the table. */
+	size_t               mem_size;        /**< bytes allocated for table. */
+	uint32_t             nb_ext;          /**< overflow blocks in slab. */
+	uint32_t             use_ext;         /**< overflow blocks in use. */
+	struct ip_frag_ext  *ext_free;        /**< free overflow blocks. */
+	uint32_t             evict_policy;    /**< eviction on full table. */
+	uint32_t             clock_hand;      /**< next entry for CLOCK sweep. */
+	uint32_t             key_len;         /**< key length of entries, 0 - any. */
+	struct rte_mempool  *copy_pool;       /**< datagram buffers, NULL - no copy. */
+	uint32_t             absorb_len;      /**< max len of absorbed fragments. */
+	struct ip_frag_pkt *cache[IP_FRAG_CACHE_SIZE];
+	/**< recently used entries, checked before hashing. */
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
 	struct ip_pkt_list lru;           /**< LRU list for table entries. */
+#else
+	uint32_t             epoch_shift;     /**< log2 of cycles per epoch. */
+	uint32_t             max_epochs;      /**< ttl for table entries. */
+	uint32_t             sweep_pos;       /**< next entry to check for ttl. */
+#endif
+	struct ip_frag_pkt *pkt;          /**< hash table. */
+	struct ip_frag_tbl_hash hash;     /**< keyed hash state. */
+	struct ip_frag_tbl_resize resize; /**< online resize state. */
+	struct ip_frag_tbl_quota quota;   /**< per-source quota state. */
+	struct ip_frag_tbl_tomb tomb;     /**< recently finished datagrams. */
+	struct ip_frag_tbl_mem mem;       /**< buffered fragments budget. */
 	struct ip_frag_tbl_stat stat;     /**< statistics counters. */
-	struct ip_frag_pkt pkt[0];        /**< hash table. */
 };
 
 /** IPv6 fragment extension header */
@@ -160,6 +353,8 @@ struct ipv6_extension_fragment {
  *   The value should be less or equal then bucket_num * bucket_entries.
  * @param max_cycles
  *   Maximum TTL in cycles for each fragmented packet.
+ *   Any other unit could be used, as long as reassembly timestamps
+ *   (tms) are given in the same unit, e.g. milliseconds.
  * @param socket_id
  *   The *socket_id* argument is the socket identifier in the case of
  *   NUMA. The value can be *SOCKET_ID_ANY* if there is no NUMA constraints.
@@ -170,6 +365,22 @@ struct rte_ip_frag_tbl * rte_ip_frag_table_create(uint32_t bucket_num,
 		uint32_t bucket_entries,  uint32_t max_entries,
 		uint64_t max_cycles, int socket_id);
 
+/*
+ * Calculate memory required for IP fragmentation table.
+ * Can be used to plan per-socket memory before tables are created.
+ *
+ * @param bucket_num
+ *   Number of buckets in the hash table.
+ * @param bucket_entries
+ *   Number of entries per bucket (e.g. hash associativity).
+ * @param max_entries
+ *   Maximum number of entries that could be stored in the table.
+ * @return
+ *   Number of bytes, or 0 if parameters are invalid.
+ */
+size_t rte_ip_frag_table_memsize(uint32_t bucket_num,
+		uint32_t bucket_entries, uint32_t max_entries);
+
 /*
  * Free allocated IP fragmentation table.
  *
@@ -179,9 +390,514 @@ struct rte_ip_frag_tbl * rte_ip_frag_table_create(uint32_t bucket_num,
 static inline void
 rte_ip_frag_table_destroy( struct rte_ip_frag_tbl *tbl)
 {
+	rte_free(tbl->quota.cnt);
+	rte_free(tbl->tomb.bits);
+	rte_free(tbl->resize.old);
+	rte_free(tbl->resize.spare);
+	rte_free(tbl->resize.retired);
+	rte_free(tbl->pkt);
 	rte_free(tbl);
 }
 
+/** online resize parameters of IP fragmentation table */
+struct rte_ip_frag_resize_params {
+	uint32_t min_bucket_num;   /**< never shrink below that many buckets. */
+	uint32_t max_bucket_num;   /**< never grow above that many buckets. */
+	uint32_t grow_load;        /**< grow when that % of max_entries in use. */
+	uint32_t shrink_load;      /**< shrink when below that % of max_entries. */
+	uint32_t step;             /**< buckets migrated per reassembly call. */
+};
+
+/*
+ * Enable or disable online resizing of IP fragmentation table.
+ * Once the load threshold is crossed, the table asks for entries array
+ * of double (or half) size. As soon as rte_ip_frag_table_resize_prepare()
+ * has allocated it, the table moves a few buckets per reassembly call
+ * into it, while lookups check both arrays. Reassembly itself never
+ * allocates or frees memory for a resize. Table max_entries is scaled
+ * along with the table size. Overflow fragment slots are not resized.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param prm
+ *   Resize parameters, NULL disables resizing.
+ *   shrink_load should be less than half of grow_load.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_resize(struct rte_ip_frag_tbl *tbl,
+		const struct rte_ip_frag_resize_params *prm);
+
+/*
+ * Allocate the entries array a resize of IP fragmentation table asks for,
+ * and free arrays that are no longer used. Meant to be called outside of
+ * the packet path, e.g. along with rte_ip_frag_check_lru(). Like other
+ * table calls, it must not run concurrently with reassembly on that table.
+ *
+ * @param tbl
+ *   Fragmentation table.
+ * @return
+ *   0 on success, -ENOMEM if allocation failed; resize is not retried
+ *   in that direction then.
+ */
+int rte_ip_frag_table_resize_prepare(struct rte_ip_frag_tbl *tbl);
+
+/** per-source quota parameters of IP fragmentation table */
+struct rte_ip_frag_quota_params {
+	uint32_t nb_counters;      /**< counters per sketch row, power of two. */
+	uint32_t max_pkts;         /**< datagrams per source, 0 - no limit. */
+	uint32_t max_bytes;        /**< fragment bytes per source, 0 - no limit. */
+};
+
+/*
+ * Enable or disable per-source admission control of IP fragmentation table.
+ * In-flight datagrams and buffered fragment bytes are accounted per IPv4
+ * source address and per IPv6 source /64 prefix, in a count-min sketch.
+ * Fragments that would put their source over the quota are dropped and
+ * counted separately from table add failures. As the sketch never
+ * underestimates, a source can only be limited early, due to collisions
+ * with other sources; size nb_counters well above the number of sources.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param prm
+ *   Quota parameters, NULL disables quotas.
+ *   New counters can only be set up while the table is empty.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_quota(struct rte_ip_frag_tbl *tbl,
+		const struct rte_ip_frag_quota_params *prm);
+
+/** tombstone filter parameters of IP fragmentation table */
+struct rte_ip_frag_tombstone_params {
+	uint32_t nb_bits;          /**< filter bits per generation, power of two. */
+	uint64_t ttl;              /**< cycles to keep keys, 0 - table ttl. */
+};
+
+/*
+ * Enable or disable the tombstone filter of IP fragmentation table.
+ * Keys of datagrams that leave the table (reassembled, dropped as invalid,
+ * expired or evicted) are recorded in a Bloom filter of two generations,
+ * the older one is cleared each ttl. A fragment that would start a new
+ * entry with a recorded key is dropped instead, so late and duplicate
+ * fragments don't hold table entries for the whole ttl. Keys are kept for
+ * ttl to twice ttl. A false positive drops the first fragment of a new
+ * datagram, so size nb_bits at 16 or more per datagram finished each ttl.
+ * A new datagram that reuses a recorded key within that time is dropped
+ * too, so ttl should be well below the time fragment ids wrap in.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param prm
+ *   Filter parameters, NULL disables the filter.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_tombstone(struct rte_ip_frag_tbl *tbl,
+		const struct rte_ip_frag_tombstone_params *prm);
+
+/** Which datagram to evict, when table is full or over its memory budget. */
+enum rte_ip_frag_evict_policy {
+	RTE_IP_FRAG_EVICT_OLDEST,         /**< first started. */
+	RTE_IP_FRAG_EVICT_LARGEST,        /**< most bytes buffered. */
+	RTE_IP_FRAG_EVICT_LEAST_COMPLETE, /**< lowest share of bytes received. */
+	RTE_IP_FRAG_EVICT_CLOCK,          /**< not hit since last CLOCK sweep. */
+	RTE_IP_FRAG_EVICT_EXPIRED,        /**< first started, if TTL expired. */
+};
+
+/** memory budget parameters of IP fragmentation table */
+struct rte_ip_frag_budget_params {
+	uint64_t max_bytes;        /**< fragment payload bytes, 0 - no limit. */
+	uint32_t max_mbufs;        /**< mbuf segments, 0 - no limit. */
+	uint32_t policy;           /**< rte_ip_frag_evict_policy. */
+};
+
+/*
+ * Set hard limits on fragments buffered by IP fragmentation table.
+ * Buffered bytes and mbufs are always accounted. Before a fragment that
+ * would exceed the budget is accepted, other datagrams are evicted,
+ * chosen by policy among the oldest few entries. If that is not possible,
+ * the fragment is dropped. Lets mempools be sized from the budget,
+ * rather than from max_entries * IP_MAX_FRAG_NUM.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param prm
+ *   Budget parameters, NULL removes limits.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_budget(struct rte_ip_frag_tbl *tbl,
+		const struct rte_ip_frag_budget_params *prm);
+
+/*
+ * Select which datagram to evict, when a new one arrives at the table
+ * holding max_entries. By default (RTE_IP_FRAG_EVICT_EXPIRED) only the
+ * oldest entry is evicted, and only if its TTL has expired, so a table
+ * full of young but hopeless datagrams rejects all new ones.
+ * Other policies always evict a live entry.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param policy
+ *   rte_ip_frag_evict_policy.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_evict(struct rte_ip_frag_tbl *tbl,
+		uint32_t policy);
+
+/** Hash functions for IP fragmentation table keys. */
+enum rte_ip_frag_hash_type {
+	RTE_IP_FRAG_HASH_CRC,      /**< CRC32 instructions, fastest. */
+	RTE_IP_FRAG_HASH_JHASH,    /**< seeded jhash. */
+	RTE_IP_FRAG_HASH_MULSHIFT, /**< multiply-shift, universal. */
+};
+
+/** hash parameters of IP fragmentation table */
+struct rte_ip_frag_hash_params {
+	uint32_t type;             /**< rte_ip_frag_hash_type. */
+	uint64_t seed;             /**< secret seed, 0 - random. */
+};
+
+/*
+ * Select the hash function of IP fragmentation table keys.
+ * Each table is keyed with its own random seed at creation, and the two
+ * buckets of a key come from independent hash values, so colliding keys
+ * in one bucket are spread over their second buckets.
+ * CRC32 is linear: its seed changes bucket positions, but not which keys
+ * collide, so it is no defense against hash flooding. Seeded jhash and
+ * multiply-shift are; the latter is also the cheapest to compute for
+ * a burst of keys at once, see rte_ip_frag_hash_bulk().
+ * By default CRC32 is used where SSE4.2 is available, jhash otherwise.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param prm
+ *   Hash parameters, NULL selects the default hash with a new random seed.
+ *   The hash can only be changed while the table is empty.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_hash(struct rte_ip_frag_tbl *tbl,
+		const struct rte_ip_frag_hash_params *prm);
+
+/*
+ * Hash a burst of keys with the hash function of IP fragmentation table.
+ * Gives the same values as lookups of the table do. CRC32 hashes several
+ * keys of the same length in interleaved chains, multiply-shift goes
+ * word by word over the whole burst.
+ *
+ * @param tbl
+ *   Fragmentation table.
+ * @param keys
+ *   Array of keys to hash.
+ * @param num
+ *   Number of keys.
+ * @param sig1
+ *   Output array of first bucket hash values.
+ * @param sig2
+ *   Output array of second bucket hash values.
+ */
+void rte_ip_frag_hash_bulk(const struct rte_ip_frag_tbl *tbl,
+		const struct ip_frag_key *keys, uint32_t num,
+		uint32_t *sig1, uint32_t *sig2);
+
+/** Address families of datagrams in IP fragmentation table. */
+enum rte_ip_frag_family {
+	RTE_IP_FRAG_FAMILY_ANY,    /**< IPv4 and IPv6. */
+	RTE_IP_FRAG_FAMILY_IPV4,   /**< IPv4 only. */
+	RTE_IP_FRAG_FAMILY_IPV6,   /**< IPv6 only. */
+};
+
+/*
+ * Restrict IP fragmentation table to one address family.
+ * Lookups in such table compare and hash keys of fixed length, without
+ * branches on the family of each key and entry. Fragments of the other
+ * family are dropped. Deployments with both families could use a table
+ * per family, or keep the default mixed table.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param family
+ *   rte_ip_frag_family.
+ *   The family can only be changed while the table is empty.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_family(struct rte_ip_frag_tbl *tbl,
+		uint32_t family);
+
+/*
+ * Switch IP fragmentation table to copy mode, or back to chaining.
+ * In copy mode an entry takes one buffer from the pool with its first
+ * fragment, payload of each fragment is copied at its offset there and
+ * the fragment mbuf goes to death row at once. So an incomplete datagram
+ * holds one mbuf, instead of one per fragment, and reassembled packets
+ * are contiguous. The data room of pool mbufs, past their headroom,
+ * should fit the largest datagram expected, and the headroom should fit
+ * L2/L3 headers of its first fragment; datagrams that don't fit are
+ * dropped. In copy mode rte_ipv4/6_frag_reassemble_bulk() doesn't complete
+ * datagrams within a burst, so that all reassembled packets are contiguous.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param pool
+ *   Pool of datagram buffers, NULL to chain fragment mbufs (default).
+ *   The mode can only be changed while the table is empty.
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_copy(struct rte_ip_frag_tbl *tbl,
+		struct rte_mempool *pool);
+
+/*
+ * Set length up to which intermediate fragments are absorbed: payload of
+ * such a fragment is copied into tailroom of the fragment right before it,
+ * if that one has already arrived, and the fragment mbuf goes to death row
+ * at once. That saves an mbuf and a chain link per tiny fragment, which
+ * floods of them (attacks, misconfigured MTU) would otherwise cost.
+ * Fragments are absorbed only when chaining; in copy mode all of them
+ * are copied anyway.
+ *
+ * @param tbl
+ *   Fragmentation table to configure.
+ * @param max_len
+ *   Max payload length of absorbed fragments, 0 to disable (default).
+ * @return
+ *   0 on success, (-1) * errno otherwise.
+ */
+int rte_ip_frag_table_set_absorb(struct rte_ip_frag_tbl *tbl,
+		uint32_t max_len);
+
+/** Fragment identification generation modes. */
+enum rte_ip_frag_id_mode {
+	RTE_IP_FRAG_ID_PER_LCORE, /**< per-lcore sequential counter. */
+	RTE_IP_FRAG_ID_PER_DST,   /**< per-destination hashed counter (RFC 7739). */
+	RTE_IP_FRAG_ID_RANDOM,    /**< pseudo-random value. */
+};
+
+/** Fragment identification generator. */
+struct rte_ip_frag_id_gen;
+
+/*
+ * Create a new fragment identification generator.
+ * All modes are lock-free and the generator can be shared between lcores.
+ *
+ * @param mode
+ *   Identification generation mode.
+ * @param nb_counters
+ *   Number of hashed counters for RTE_IP_FRAG_ID_PER_DST mode,
+ *   rounded up to power of two. Ignored for other modes.
+ * @param socket_id
+ *   The *socket_id* argument is the socket identifier in the case of
+ *   NUMA. The value can be *SOCKET_ID_ANY* if there is no NUMA constraints.
+ * @return
+ *   The pointer to the new allocated generator, on success. NULL on error.
+ */
+struct rte_ip_frag_id_gen *rte_ip_frag_id_gen_create(
+		enum rte_ip_frag_id_mode mode, uint32_t nb_counters, int socket_id);
+
+/*
+ * Free allocated fragment identification generator.
+ *
+ * @param gen
+ *   Generator to free.
+ */
+static inline void
+rte_ip_frag_id_gen_destroy(struct rte_ip_frag_id_gen *gen)
+{
+	rte_free(gen);
+}
+
+/*
+ * Get identification for the next fragmented IPv4 datagram.
+ *
+ * @param gen
+ *   Generator to use, NULL selects the per-lcore counter.
+ * @param hdr
+ *   IPv4 header of the datagram.
+ * @return
+ *   Identification in host byte order.
+ */
+uint16_t rte_ipv4_frag_id_next(struct rte_ip_frag_id_gen *gen,
+		const struct ipv4_hdr *hdr);
+
+/*
+ * Get identification for the next fragmented IPv6 datagram.
+ *
+ * @param gen
+ *   Generator to use, NULL selects the per-lcore counter.
+ * @param hdr
+ *   IPv6 header of the datagram.
+ * @return
+ *   Identification in host byte order.
+ */
+uint32_t rte_ipv6_frag_id_next(struct rte_ip_frag_id_gen *gen,
+		const struct ipv6_hdr *hdr);
+
+/** How fragmenters spread the payload over the output fragments. */
+enum rte_ip_frag_size_mode {
+	RTE_IP_FRAG_SIZE_FILL,  /**< fill up to the MTU, remainder last. */
+	RTE_IP_FRAG_SIZE_EQUAL, /**< even split over the fewest fragments. */
+	RTE_IP_FRAG_SIZE_BUF,   /**< fragments fill whole downstream buffers. */
+};
+
+/*
+ * Get the MTU to pass to rte_ipv4_fragment_packet() and its variants,
+ * so that the fragments of the given packet follow the sizing mode.
+ * The payload of all but the last fragment stays a multiple of 8.
+ *
+ * RTE_IP_FRAG_SIZE_EQUAL keeps the number of fragments of
+ * RTE_IP_FRAG_SIZE_FILL, but avoids a tiny last one.
+ * RTE_IP_FRAG_SIZE_BUF makes each fragment fit into as many whole
+ * buffers of buf_size bytes as the MTU allows, if it allows one.
+ *
+ * @param pkt_in
+ *   The packet to fragment.
+ * @param mtu_size
+ *   Size in bytes of the egress MTU, including the IPv4 header.
+ * @param mode
+ *   Fragment sizing mode.
+ * @param buf_size
+ *   Downstream buffer size for RTE_IP_FRAG_SIZE_BUF, ignored otherwise.
+ * @return
+ *   MTU to fragment with, never above mtu_size.
+ */
+uint16_t rte_ipv4_frag_size_mtu(const struct rte_mbuf *pkt_in,
+		uint16_t mtu_size, enum rte_ip_frag_size_mode mode,
+		uint16_t buf_size);
+
+/*
+ * Same as rte_ipv4_frag_size_mtu(), for rte_ipv6_fragment_packet()
+ * and its variants. mtu_size includes the IPv6 header.
+ */
+uint16_t rte_ipv6_frag_size_mtu(const struct rte_mbuf *pkt_in,
+		uint16_t mtu_size, enum rte_ip_frag_size_mode mode,
+		uint16_t buf_size);
+
+/** Per-destination path MTU cache. */
+struct rte_ip_frag_pmtu;
+
+/*
+ * Create a new path MTU cache, keyed by IPv4 or IPv6 destination.
+ * Lookups take no lock and the cache can be shared between lcores,
+ * updates may come from any lcore as well.
+ *
+ * @param nb_entries
+ *   Number of destinations to cache, rounded up to power of two.
+ * @param ttl
+ *   Lifetime of an entry in TSC cycles, 0 to keep entries until
+ *   replaced. Expired destinations fall back to the link MTU,
+ *   so that the path MTU can grow again (RFC 1191, section 6.3).
+ * @param socket_id
+ *   The *socket_id* argument is the socket identifier in the case of
+ *   NUMA. The value can be *SOCKET_ID_ANY* if there is no NUMA constraints.
+ * @return
+ *   The pointer to the new allocated cache, on success. NULL on error.
+ */
+struct rte_ip_frag_pmtu *rte_ip_frag_pmtu_create(uint32_t nb_entries,
+		uint64_t ttl, int socket_id);
+
+/*
+ * Free allocated path MTU cache.
+ *
+ * @param pc
+ *   Cache to free.
+ */
+static inline void
+rte_ip_frag_pmtu_destroy(struct rte_ip_frag_pmtu *pc)
+{
+	rte_free(pc);
+}
+
+/*
+ * Set path MTU towards an IPv4 destination, e.g. from the control plane.
+ * When the cache is full, an expired entry or the one to expire first
+ * is replaced.
+ *
+ * @param pc
+ *   Path MTU cache.
+ * @param dst_addr
+ *   Destination address, in network byte order.
+ * @param mtu
+ *   Path MTU, 0 removes the destination.
+ * @param tms
+ *   Current time, TSC cycles.
+ * @return
+ *   0 on success, -EBUSY if another lcore was updating the same entry,
+ *   -EINVAL on invalid input.
+ */
+int rte_ipv4_frag_pmtu_update(struct rte_ip_frag_pmtu *pc, uint32_t dst_addr,
+		uint16_t mtu, uint64_t tms);
+
+/*
+ * Same as rte_ipv4_frag_pmtu_update(), for a 16 bytes IPv6 destination.
+ */
+int rte_ipv6_frag_pmtu_update(struct rte_ip_frag_pmtu *pc,
+		const uint8_t dst_addr[], uint16_t mtu, uint64_t tms);
+
+/*
+ * Learn path MTU from an ICMP destination unreachable, fragmentation
+ * needed message (RFC 1191). Reports may only lower the path MTU
+ * of a live entry; reports without next-hop MTU, below 68 bytes or
+ * not below the size of the quoted packet are ignored.
+ *
+ * @param pc
+ *   Path MTU cache.
+ * @param icmp
+ *   ICMP header, followed by the quoted IPv4 header.
+ * @param len
+ *   Bytes available at icmp.
+ * @param tms
+ *   Current time, TSC cycles.
+ * @return
+ *   0 on success, -EINVAL if the message is ignored,
+ *   -EBUSY if another lcore was updating the same entry.
+ */
+int rte_ipv4_frag_pmtu_icmp(struct rte_ip_frag_pmtu *pc, const void *icmp,
+		uint32_t len, uint64_t tms);
+
+/*
+ * Same as rte_ipv4_frag_pmtu_icmp(), for an ICMPv6 packet too big
+ * message (RFC 8201). Reports below 1280 bytes set 1280.
+ */
+int rte_ipv6_frag_pmtu_icmp(struct rte_ip_frag_pmtu *pc, const void *icmp,
+		uint32_t len, uint64_t tms);
+
+/*
+ * Get path MTUs for a burst of IPv4 packets to fragment, to pass as
+ * mtu_size to rte_ipv4_fragment_packet() and its variants.
+ * Buckets of a burst are prefetched before any of them is searched.
+ *
+ * @param pc
+ *   Path MTU cache.
+ * @param mb
+ *   Packets, starting at their IPv4 header.
+ * @param num
+ *   Number of packets.
+ * @param mtu_size
+ *   Link MTU, used for uncached destinations and as upper bound.
+ * @param mtu
+ *   Array of num entries, filled with the MTU per packet.
+ * @param tms
+ *   Current time, TSC cycles.
+ * @return
+ *   Number of packets with a cached path MTU.
+ */
+uint32_t rte_ipv4_frag_pmtu_lookup_bulk(const struct rte_ip_frag_pmtu *pc,
+		struct rte_mbuf *mb[], uint32_t num, uint16_t mtu_size,
+		uint16_t mtu[], uint64_t tms);
+
+/*
+ * Same as rte_ipv4_frag_pmtu_lookup_bulk(), for packets starting
+ * at their IPv6 header.
+ */
+uint32_t rte_ipv6_frag_pmtu_lookup_bulk(const struct rte_ip_frag_pmtu *pc,
+		struct rte_mbuf *mb[], uint32_t num, uint16_t mtu_size,
+		uint16_t mtu[], uint64_t tms);
+
 /**
  * This function implements the fragmentation of IPv6 packets.
  *
@@ -211,9 +927,67 @@ rte_ipv6_fragment_packet(struct rte_mbuf *pkt_in,
 		struct rte_mempool *pool_direct,
 		struct rte_mempool *pool_indirect);
 
+/**
+ * Same as rte_ipv6_fragment_packet(), with the fragment identification
+ * taken from the given generator. An input that is already a fragment
+ * is rejected with -EINVAL, no identification is taken for a packet
+ * that cannot be fragmented.
+ *
+ * @param id_gen
+ *   Fragment identification generator, NULL selects the per-lcore counter.
+ */
+int32_t
+rte_ipv6_fragment_packet_idgen(struct rte_mbuf *pkt_in,
+		struct rte_mbuf **pkts_out,
+		uint16_t nb_pkts_out,
+		uint16_t mtu_size,
+		struct rte_mempool *pool_direct,
+		struct rte_mempool *pool_indirect,
+		struct rte_ip_frag_id_gen *id_gen);
+
+/**
+ * Refragments an IPv6 fragment for a smaller egress MTU, without
+ * reassembly. Output fragments reference the input data through
+ * indirect mbufs, keep its identification and are offset relative
+ * to it; the last one keeps its M flag. A packet without fragment
+ * header is fragmented as by rte_ipv6_fragment_packet().
+ *
+ * @param pkt_in
+ *   The input fragment, consumed on success. If it fits into
+ *   mtu_size already, it is passed through as the only output.
+ * @param pkts_out
+ *   Array storing the output fragments.
+ * @param nb_pkts_out
+ *   Number of entries in pkts_out.
+ * @param mtu_size
+ *   Size in bytes of the egress MTU, including the IPv6 header.
+ *   Fragment payload is rounded down to a multiple of 8.
+ * @param pool_direct
+ *   MBUF pool used for allocating direct buffers for the output fragments.
+ * @param pool_indirect
+ *   MBUF pool used for allocating indirect buffers for the output fragments.
+ * @return
+ *   Upon successful completion - number of output fragments placed
+ *   in the pkts_out array.
+ *   Otherwise - (-1) * errno, pkt_in is left to the caller.
+ */
+int32_t
+rte_ipv6_refragment_packet(struct rte_mbuf *pkt_in,
+		struct rte_mbuf **pkts_out,
+		uint16_t nb_pkts_out,
+		uint16_t mtu_size,
+		struct rte_mempool *pool_direct,
+		struct rte_mempool *pool_indirect);
+
 /*
  * This function implements reassembly of fragmented IPv6 packets.
  * Incoming mbuf should have its l2_len/l3_len fields setup correctly.
+ * Fragments could be multi-segment mbufs (e.g. scattered RX), their
+ * segments are linked without walking the chains again. The first
+ * l2_len + l3_len bytes (L2, IPv6 and extension headers) of the fragment
+ * with offset 0 should be within its first segment, the fragment header
+ * is removed in place there. Headers of other fragments could span
+ * segments, the ones left empty are freed.
  *
  * @param tbl
  *   Table where to lookup/add the fragmented packet.
@@ -237,6 +1011,110 @@ struct rte_mbuf *rte_ipv6_frag_reassemble_packet(struct rte_ip_frag_tbl *tbl,
 		struct rte_mbuf *mb, uint64_t tms, struct ipv6_hdr *ip_hdr,
 		struct ipv6_extension_fragment *frag_hdr);
 
+/*
+ * Reassemble a burst of fragmented IPv6 packets.
+ * Keys of the whole burst are hashed together, which is cheaper than
+ * hashing them one by one, see rte_ip_frag_hash_bulk().
+ * Datagrams with all their fragments within IP_FRAG_HASH_BURST (32) mbufs of
+ * the burst are reassembled without being added to the table, so source
+ * quota and buffer budget don't apply to them. The reassembled packet
+ * takes the place of the last fragment to arrive.
+ * Incoming mbufs should have their l2_len/l3_len fields setup correctly,
+ * with the fragment extension header being the last one within l3_len.
+ * The l2_len + l3_len header bytes should be within the first segment.
+ * Death row should be emptied after each burst of up to
+ * IP_FRAG_DEATH_ROW_LEN packets.
+ *
+ * @param tbl
+ *   Table where to lookup/add the fragmented packets.
+ * @param dr
+ *   Death row to free buffers to
+ * @param mb
+ *   Array of incoming mbufs with IPv6 fragments. On return, each of them
+ *   is replaced with the reassembled packet, or NULL if:
+ *   - an error occured.
+ *   - not all fragments of the packet are collected yet.
+ * @param num
+ *   Number of mbufs in the array.
+ * @param tms
+ *   Fragments arrival timestamp.
+ * @return
+ *   Number of reassembled packets.
+ */
+uint32_t rte_ipv6_frag_reassemble_bulk(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr,
+		struct rte_mbuf **mb, uint32_t num, uint64_t tms);
+
+/*
+ * Virtual reassembly of fragmented IPv6 packets: forward each fragment as
+ * soon as the first fragment of its datagram tells the L4 flow, instead of
+ * building the datagram. Fragments that come ahead of the first one are
+ * kept in the table until it arrives, or the datagram expires.
+ * Each forwarded fragment gets the first 4 bytes of the datagram L4 header
+ * (source and destination ports of TCP, UDP, SCTP), as they are in the
+ * packet, in hash.usr. With addresses and protocol in the fragment headers,
+ * that makes the 5-tuple to classify any fragment by.
+ * Datagrams with a first fragment too short for that are dropped.
+ * A table should either reassemble, forward or classify datagrams,
+ * and can't forward or classify in copy mode.
+ * Incoming mbuf should have its l2_len/l3_len fields setup correctly,
+ * with the fragment extension header being the last one within l3_len.
+ *
+ * @param tbl
+ *   Table where to lookup/add the fragmented packet.
+ * @param dr
+ *   Death row to free buffers to
+ * @param mb
+ *   Incoming mbuf with IPv6 fragment.
+ * @param tms
+ *   Fragment arrival timestamp.
+ * @param ip_hdr
+ *   Pointer to the IPv6 header.
+ * @param frag_hdr
+ *   Pointer to the IPv6 fragment extension header.
+ * @param out
+ *   Array of at least IP_MAX_FRAG_NUM entries, to store fragments
+ *   to forward: the incoming one and those that waited for it.
+ * @return
+ *   Number of fragments stored into out.
+ */
+uint32_t rte_ipv6_frag_forward_packet(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr,
+		struct rte_mbuf *mb, uint64_t tms, struct ipv6_hdr *ip_hdr,
+		struct ipv6_extension_fragment *frag_hdr, struct rte_mbuf **out);
+
+/*
+ * Classify a burst of IPv6 fragments by the L4 flow of their datagrams,
+ * for flow-consistent steering without reassembly. The first fragment of
+ * each datagram records its L4 ports in the table, for later fragments to
+ * look up, until all of the datagram is seen or it expires. Mbufs are only
+ * tagged: fragments of a datagram with known flow get a hash of addresses,
+ * protocol and ports in hash.rss and PKT_RX_RSS_HASH set, others (those
+ * ahead of the first fragment, or not fitting the table) get the flag
+ * cleared. The hash is the same for all datagrams of a flow, but not
+ * the one NICs compute for unfragmented packets.
+ * A table should either reassemble, forward or classify datagrams,
+ * and can't classify in copy mode.
+ * Incoming mbufs should have their l2_len/l3_len fields setup correctly,
+ * with the fragment extension header being the last one within l3_len.
+ *
+ * @param tbl
+ *   Table where to lookup/add the datagrams.
+ * @param dr
+ *   Death row, for the table to free buffers of evicted entries to.
+ * @param mb
+ *   Array of incoming mbufs with IPv6 fragments.
+ * @param num
+ *   Number of mbufs in the array.
+ * @param tms
+ *   Fragments arrival timestamp.
+ * @return
+ *   Number of fragments tagged with the flow hash.
+ */
+uint32_t rte_ipv6_frag_flow_bulk(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr,
+		struct rte_mbuf **mb, uint32_t num, uint64_t tms);
+
 /*
  * Return a pointer to the packet's fragment header, if found.
  * It only looks at the extension header that's right after the fixed IPv6
@@ -287,9 +1165,59 @@ int32_t rte_ipv4_fragment_packet(struct rte_mbuf *pkt_in,
 			struct rte_mempool *pool_direct,
 			struct rte_mempool *pool_indirect);
 
+/**
+ * Same as rte_ipv4_fragment_packet(), but assigns a new identification
+ * taken from the given generator to all output fragments, instead of
+ * keeping the one from the input packet. An input that is already
+ * a fragment is rejected with -EINVAL, no identification is taken for
+ * a packet that cannot be fragmented.
+ *
+ * @param id_gen
+ *   Fragment identification generator, NULL selects the per-lcore counter.
+ */
+int32_t rte_ipv4_fragment_packet_idgen(struct rte_mbuf *pkt_in,
+			struct rte_mbuf **pkts_out,
+			uint16_t nb_pkts_out, uint16_t mtu_size,
+			struct rte_mempool *pool_direct,
+			struct rte_mempool *pool_indirect,
+			struct rte_ip_frag_id_gen *id_gen);
+
+/**
+ * Refragments an IPv4 fragment for a smaller egress MTU, without
+ * reassembly. Output fragments reference the input data through
+ * indirect mbufs, keep its identification and are offset relative
+ * to it; the last one keeps its MF flag.
+ *
+ * @param pkt_in
+ *   The input fragment, consumed on success. If it fits into
+ *   mtu_size already, it is passed through as the only output.
+ * @param pkts_out
+ *   Array storing the output fragments.
+ * @param nb_pkts_out
+ *   Number of entries in pkts_out.
+ * @param mtu_size
+ *   Size in bytes of the egress MTU, including the IPv4 header.
+ *   Fragment payload is rounded down to a multiple of 8.
+ * @param pool_direct
+ *   MBUF pool used for allocating direct buffers for the output fragments.
+ * @param pool_indirect
+ *   MBUF pool used for allocating indirect buffers for the output fragments.
+ * @return
+ *   Upon successful completion - number of output fragments placed
+ *   in the pkts_out array.
+ *   Otherwise - (-1) * errno, pkt_in is left to the caller.
+ */
+int32_t rte_ipv4_refragment_packet(struct rte_mbuf *pkt_in,
+			struct rte_mbuf **pkts_out,
+			uint16_t nb_pkts_out, uint16_t mtu_size,
+			struct rte_mempool *pool_direct,
+			struct rte_mempool *pool_indirect);
+
 /*
  * This function implements reassembly of fragmented IPv4 packets.
  * Incoming mbufs should have its l2_len/l3_len fields setup correclty.
+ * Fragments could be multi-segment mbufs (e.g. scattered RX), their
+ * segments are linked without walking the chains again.
  *
  * @param tbl
  *   Table where to lookup/add the fragmented packet.
@@ -310,6 +1238,88 @@ struct rte_mbuf * rte_ipv4_frag_reassemble_packet(struct rte_ip_frag_tbl *tbl,
 		struct rte_ip_frag_death_row *dr,
 		struct rte_mbuf *mb, uint64_t tms, struct ipv4_hdr *ip_hdr);
 
+/*
+ * Reassemble a burst of fragmented IPv4 packets.
+ * Keys of the whole burst are hashed together, which is cheaper than
+ * hashing them one by one, see rte_ip_frag_hash_bulk().
+ * Datagrams with all their fragments within IP_FRAG_HASH_BURST (32) mbufs of
+ * the burst are reassembled without being added to the table, so source
+ * quota and buffer budget don't apply to them. The reassembled packet
+ * takes the place of the last fragment to arrive.
+ * Incoming mbufs should have their l2_len/l3_len fields setup correctly.
+ * Death row should be emptied after each burst of up to
+ * IP_FRAG_DEATH_ROW_LEN packets.
+ *
+ * @param tbl
+ *   Table where to lookup/add the fragmented packets.
+ * @param dr
+ *   Death row to free buffers to
+ * @param mb
+ *   Array of incoming mbufs with IPv4 fragments. On return, each of them
+ *   is replaced with the reassembled packet, or NULL if:
+ *   - an error occured.
+ *   - not all fragments of the packet are collected yet.
+ * @param num
+ *   Number of mbufs in the array.
+ * @param tms
+ *   Fragments arrival timestamp.
+ * @return
+ *   Number of reassembled packets.
+ */
+uint32_t rte_ipv4_frag_reassemble_bulk(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr,
+		struct rte_mbuf **mb, uint32_t num, uint64_t tms);
+
+/*
+ * Virtual reassembly of fragmented IPv4 packets: forward each fragment as
+ * soon as the first fragment of its datagram tells the L4 flow, instead of
+ * building the datagram. See rte_ipv6_frag_forward_packet().
+ * Incoming mbuf should have its l2_len/l3_len fields setup correctly.
+ *
+ * @param tbl
+ *   Table where to lookup/add the fragmented packet.
+ * @param dr
+ *   Death row to free buffers to
+ * @param mb
+ *   Incoming mbuf with IPv4 fragment.
+ * @param tms
+ *   Fragment arrival timestamp.
+ * @param ip_hdr
+ *   Pointer to the IPv4 header inside the fragment.
+ * @param out
+ *   Array of at least IP_MAX_FRAG_NUM entries, to store fragments
+ *   to forward: the incoming one and those that waited for it.
+ * @return
+ *   Number of fragments stored into out.
+ */
+uint32_t rte_ipv4_frag_forward_packet(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr,
+		struct rte_mbuf *mb, uint64_t tms, struct ipv4_hdr *ip_hdr,
+		struct rte_mbuf **out);
+
+/*
+ * Classify a burst of IPv4 fragments by the L4 flow of their datagrams,
+ * for flow-consistent steering without reassembly.
+ * See rte_ipv6_frag_flow_bulk().
+ * Incoming mbufs should have their l2_len/l3_len fields setup correctly.
+ *
+ * @param tbl
+ *   Table where to lookup/add the datagrams.
+ * @param dr
+ *   Death row, for the table to free buffers of evicted entries to.
+ * @param mb
+ *   Array of incoming mbufs with IPv4 fragments.
+ * @param num
+ *   Number of mbufs in the array.
+ * @param tms
+ *   Fragments arrival timestamp.
+ * @return
+ *   Number of fragments tagged with the flow hash.
+ */
+uint32_t rte_ipv4_frag_flow_bulk(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr,
+		struct rte_mbuf **mb, uint32_t num, uint64_t tms);
+
 /*
  * Check if the IPv4 packet is fragmented
  *
@@ -352,8 +1362,40 @@ void
 rte_ip_frag_table_statistics_dump(FILE * f, const struct rte_ip_frag_tbl *tbl);
 
 
+RTE_DECLARE_PER_LCORE(uint64_t, ip_frag_clock); /**< @internal */
+
+/**
+ * Update coarse reassembly clock of the calling lcore.
+ * Meant to be called once per received burst, so that per-fragment code
+ * reads the cached value, instead of serializing on the TSC.
+ *
+ * @return
+ *   Current TSC value.
+ */
+static inline uint64_t
+rte_ip_frag_clock_update(void)
+{
+	RTE_PER_LCORE(ip_frag_clock) = rte_rdtsc();
+	return RTE_PER_LCORE(ip_frag_clock);
+}
+
+/**
+ * Read coarse reassembly clock of the calling lcore.
+ *
+ * @return
+ *   TSC value as of the last rte_ip_frag_clock_update() call.
+ */
+static inline uint64_t
+rte_ip_frag_clock(void)
+{
+	return RTE_PER_LCORE(ip_frag_clock);
+}
+
 /**
- * Check the LRU entry and move to death row if expired
+ * Check the LRU entry and move to death row if expired.
+ * With RTE_LIBRTE_IP_FRAG_EPOCH_AGING, all entries of the next bucket
+ * are checked instead, so the whole table is swept in
+ * nb_buckets * 2 calls.
  *
  * @param tbl
  * @param dr
@@ -36,10 +36,21 @@
 
 #include <rte_memory.h>
 #include <rte_log.h>
+#include <rte_random.h>
 
 #include "ip_frag_common.h"
 
-#define	IP_FRAG_HASH_FNUM	2
+/* coarse reassembly clock, updated once per burst */
+RTE_DEFINE_PER_LCORE(uint64_t, ip_frag_clock);
+
+/* one of that many entries could use all overflow fragment slots */
+#define	IP_FRAG_EXT_RATIO	4
+
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+#define	IP_FRAG_HASH_DEFAULT	RTE_IP_FRAG_HASH_CRC
+#else
+#define	IP_FRAG_HASH_DEFAULT	RTE_IP_FRAG_HASH_JHASH
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
 
 /* free mbufs from death row */
 void
@@ -68,33 +79,96 @@ rte_ip_frag_free_death_row(struct rte_ip_frag_death_row *dr,
 	dr->cnt = 0;
 }
 
+/* expand the seed into hash keys (splitmix64), or take random ones */
+static void
+ip_frag_hash_seed(struct ip_frag_tbl_hash *hs, uint64_t seed)
+{
+	uint32_t i, j;
+	uint64_t v, x;
+
+	x = seed;
+	for (i = 0; i != RTE_DIM(hs->mul); i++) {
+		for (j = 0; j != RTE_DIM(hs->mul[i]) + 1; j++) {
+			if (seed == 0)
+				v = rte_rand();
+			else {
+				x += 0x9e3779b97f4a7c15ULL;
+				v = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				v = (v ^ (v >> 27)) * 0x94d049bb133111ebULL;
+				v ^= v >> 31;
+			}
+			if (j != RTE_DIM(hs->mul[i]))
+				hs->mul[i][j] = v;
+			else
+				hs->seed[i] = (uint32_t)v;
+		}
+	}
+}
+
+/* calculate fragmentation table geometry, returns 0 on invalid input */
+static size_t
+ip_frag_tbl_size(uint32_t bucket_num, uint32_t bucket_entries,
+	uint32_t max_entries, uint32_t *nb_entries, uint32_t *nb_ext)
+{
+	uint64_t n;
+
+	n = rte_align32pow2(bucket_num);
+	n *= bucket_entries;
+	n *= IP_FRAG_HASH_FNUM;
+
+	/* check input parameters. */
+	if (rte_is_power_of_2(bucket_entries) == 0 ||
+			n > UINT32_MAX || n == 0 || n < max_entries)
+		return 0;
+
+	/* overflow fragment slots are placed right after the table header. */
+	*nb_entries = (uint32_t)n;
+	*nb_ext = (uint32_t)(((uint64_t)max_entries * IP_FRAG_EXT_BLOCKS +
+		IP_FRAG_EXT_RATIO - 1) / IP_FRAG_EXT_RATIO);
+
+	return sizeof (struct rte_ip_frag_tbl) +
+		n * sizeof (struct ip_frag_pkt) +
+		*nb_ext * sizeof (struct ip_frag_ext);
+}
+
+/* memory required for fragmentation table */
+size_t
+rte_ip_frag_table_memsize(uint32_t bucket_num, uint32_t bucket_entries,
+	uint32_t max_entries)
+{
+	uint32_t nb_entries, nb_ext;
+
+	return ip_frag_tbl_size(bucket_num, bucket_entries, max_entries,
+		&nb_entries, &nb_ext);
+}
+
 /* create fragmentation table */
 struct rte_ip_frag_tbl *
 rte_ip_frag_table_create(uint32_t bucket_num, uint32_t bucket_entries,
 	uint32_t max_entries, uint64_t max_cycles, int socket_id)
 {
 	struct rte_ip_frag_tbl *tbl;
+	struct ip_frag_ext *ext;
 	size_t sz;
-	uint64_t nb_entries;
-
-	nb_entries = rte_align32pow2(bucket_num);
-	nb_entries *= bucket_entries;
-	nb_entries *= IP_FRAG_HASH_FNUM;
+	uint32_t i, nb_entries, nb_ext;
 
-	/* check input parameters. */
-	if (rte_is_power_of_2(bucket_entries) == 0 ||
-			nb_entries > UINT32_MAX || nb_entries == 0 ||
-			nb_entries < max_entries) {
+	sz = ip_frag_tbl_size(bucket_num, bucket_entries, max_entries,
+		&nb_entries, &nb_ext);
+	if (sz == 0) {
 		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
 		return NULL;
 	}
 
-	sz = sizeof (*tbl) + nb_entries * sizeof (tbl->pkt[0]);
-	if ((tbl = rte_zmalloc_socket(__func__, sz, RTE_CACHE_LINE_SIZE,
-			socket_id)) == NULL) {
+	if ((tbl = rte_zmalloc_socket(__func__,
+			sz - nb_entries * sizeof (tbl->pkt[0]),
+			RTE_CACHE_LINE_SIZE, socket_id)) == NULL ||
+			(tbl->pkt = rte_zmalloc_socket(__func__,
+			nb_entries * sizeof (tbl->pkt[0]),
+			RTE_CACHE_LINE_SIZE, socket_id)) == NULL) {
 		RTE_LOG(ERR, USER1,
 			"%s: allocation of %zu bytes at socket %d failed do\n",
 			__func__, sz, socket_id);
+		rte_free(tbl);
 		return NULL;
 	}
 
@@ -103,15 +177,484 @@ rte_ip_frag_table_create(uint32_t bucket_num, uint32_t bucket_entries,
 
 	tbl->max_cycles = max_cycles;
 	tbl->max_entries = max_entries;
-	tbl->nb_entries = (uint32_t)nb_entries;
+	tbl->nb_entries = nb_entries;
 	tbl->nb_buckets = bucket_num;
 	tbl->bucket_entries = bucket_entries;
 	tbl->entry_mask = (tbl->nb_entries - 1) & ~(tbl->bucket_entries  - 1);
 
+	/* build overflow slots free list. */
+	ext = (struct ip_frag_ext *)(tbl + 1);
+	for (i = 0; i != nb_ext; i++)
+		ext[i].next = (i + 1 != nb_ext) ? ext + i + 1 : NULL;
+	tbl->ext_free = (nb_ext != 0) ? ext : NULL;
+	tbl->nb_ext = nb_ext;
+
+	tbl->socket_id = socket_id;
+	tbl->mem_size = sz;
+	tbl->mem.max_bytes = UINT64_MAX;
+	tbl->mem.max_mbufs = UINT32_MAX;
+	tbl->evict_policy = RTE_IP_FRAG_EVICT_EXPIRED;
+	tbl->hash.type = IP_FRAG_HASH_DEFAULT;
+	ip_frag_hash_seed(&tbl->hash, 0);
+
+#ifndef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
 	TAILQ_INIT(&(tbl->lru));
+#else
+	/* split ttl into IP_FRAG_TTL_EPOCHS or a bit more epochs. */
+	while ((max_cycles >> tbl->epoch_shift) >= 2 * IP_FRAG_TTL_EPOCHS)
+		tbl->epoch_shift++;
+	tbl->max_epochs = (uint32_t)(max_cycles >> tbl->epoch_shift);
+#endif
+
 	return tbl;
 }
 
+/* configure online resizing of frag table */
+int
+rte_ip_frag_table_set_resize(struct rte_ip_frag_tbl *tbl,
+	const struct rte_ip_frag_resize_params *prm)
+{
+	struct ip_frag_tbl_resize *rs;
+	uint64_t min_entries, max_entries;
+
+	rs = &tbl->resize;
+
+	/* make thresholds unreachable, let pending migration complete. */
+	if (prm == NULL) {
+		rs->grow_use = UINT32_MAX;
+		rs->shrink_use = 0;
+		rs->want = 0;
+		if (rs->old == NULL)
+			rs->step = 0;
+		return 0;
+	}
+
+	min_entries = rte_align32pow2(prm->min_bucket_num);
+	min_entries *= tbl->bucket_entries * IP_FRAG_HASH_FNUM;
+	max_entries = rte_align32pow2(prm->max_bucket_num);
+	max_entries *= tbl->bucket_entries * IP_FRAG_HASH_FNUM;
+
+	/* check input parameters. */
+	if (prm->step == 0 || prm->grow_load == 0 || prm->grow_load > 100 ||
+			prm->shrink_load * 2 >= prm->grow_load ||
+			min_entries == 0 || min_entries > tbl->nb_entries ||
+			max_entries < tbl->nb_entries || max_entries > UINT32_MAX) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	rs->step = prm->step;
+	rs->min_entries = (uint32_t)min_entries;
+	rs->max_entries = (uint32_t)max_entries;
+	rs->grow_load = prm->grow_load;
+	rs->shrink_load = prm->shrink_load;
+	ip_frag_tbl_resize_limits(tbl);
+	return 0;
+}
+
+/* allocate and free entries arrays for online resize of frag table */
+int
+rte_ip_frag_table_resize_prepare(struct rte_ip_frag_tbl *tbl)
+{
+	struct ip_frag_tbl_resize *rs;
+	struct ip_frag_pkt *pkt;
+	size_t sz;
+
+	rs = &tbl->resize;
+
+	/* array of the finished migration. */
+	if (rs->retired != NULL) {
+		rte_free(rs->retired);
+		tbl->mem_size -= rs->retired_nb_entries * sizeof(*pkt);
+		rs->retired = NULL;
+		rs->retired_nb_entries = 0;
+	}
+
+	/* load went back, or the other way. */
+	if (rs->spare != NULL && rs->spare_nb_entries != rs->want) {
+		rte_free(rs->spare);
+		tbl->mem_size -= rs->spare_nb_entries * sizeof(*pkt);
+		rs->spare = NULL;
+		rs->spare_nb_entries = 0;
+	}
+
+	if (rs->want == 0 || rs->spare != NULL || rs->old != NULL)
+		return 0;
+
+	sz = rs->want * sizeof(*pkt);
+	if ((pkt = rte_zmalloc_socket(__func__, sz, RTE_CACHE_LINE_SIZE,
+			tbl->socket_id)) == NULL) {
+		RTE_LOG(ERR, USER1,
+			"%s: allocation of %zu bytes at socket %d failed\n",
+			__func__, sz, tbl->socket_id);
+
+		/* don't retry every time, stay at the current size. */
+		if (rs->want > tbl->nb_entries)
+			rs->max_entries = tbl->nb_entries;
+		else
+			rs->min_entries = tbl->nb_entries;
+		rs->want = 0;
+		return -ENOMEM;
+	}
+
+	rs->spare = pkt;
+	rs->spare_nb_entries = rs->want;
+	tbl->mem_size += sz;
+	return 0;
+}
+
+/* configure per-source quotas of frag table */
+int
+rte_ip_frag_table_set_quota(struct rte_ip_frag_tbl *tbl,
+	const struct rte_ip_frag_quota_params *prm)
+{
+	struct ip_frag_tbl_quota *qt;
+	size_t sz;
+
+	qt = &tbl->quota;
+
+	if (prm == NULL) {
+		if (qt->cnt != NULL) {
+			tbl->mem_size -= (qt->mask + 1) * IP_FRAG_QUOTA_ROWS *
+				sizeof (qt->cnt[0]);
+			rte_free(qt->cnt);
+			qt->cnt = NULL;
+		}
+		return 0;
+	}
+
+	/* check input parameters. */
+	if (rte_is_power_of_2(prm->nb_counters) == 0 ||
+			prm->nb_counters > UINT16_MAX + 1) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	/* keep the counters, if only limits change. */
+	if (qt->cnt == NULL || qt->mask + 1 != prm->nb_counters) {
+
+		/* counters have to match datagrams in the table. */
+		if (tbl->use_entries != 0)
+			return -EBUSY;
+
+		rte_ip_frag_table_set_quota(tbl, NULL);
+
+		sz = (size_t)prm->nb_counters * IP_FRAG_QUOTA_ROWS *
+			sizeof (qt->cnt[0]);
+		if ((qt->cnt = rte_zmalloc_socket(__func__, sz,
+				RTE_CACHE_LINE_SIZE, tbl->socket_id)) == NULL) {
+			RTE_LOG(ERR, USER1,
+				"%s: allocation of %zu bytes at socket %d failed\n",
+				__func__, sz, tbl->socket_id);
+			return -ENOMEM;
+		}
+
+		qt->mask = prm->nb_counters - 1;
+		tbl->mem_size += sz;
+	}
+
+	qt->max_pkts = prm->max_pkts;
+	qt->max_bytes = prm->max_bytes;
+	return 0;
+}
+
+/* set up filter of recently finished datagrams */
+int
+rte_ip_frag_table_set_tombstone(struct rte_ip_frag_tbl *tbl,
+	const struct rte_ip_frag_tombstone_params *prm)
+{
+	struct ip_frag_tbl_tomb *tb;
+	size_t sz;
+
+	tb = &tbl->tomb;
+
+	if (prm == NULL) {
+		if (tb->bits != NULL) {
+			tbl->mem_size -= 2 * (tb->mask + 1) / 8;
+			rte_free(tb->bits);
+			tb->bits = NULL;
+		}
+		return 0;
+	}
+
+	/* check input parameters. */
+	if (rte_is_power_of_2(prm->nb_bits) == 0 ||
+			prm->nb_bits < 64 || prm->nb_bits > INT32_MAX) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	/* keep recorded keys, if only ttl changes. */
+	if (tb->bits == NULL || tb->mask + 1 != prm->nb_bits) {
+
+		rte_ip_frag_table_set_tombstone(tbl, NULL);
+
+		sz = 2 * (size_t)prm->nb_bits / 8;
+		if ((tb->bits = rte_zmalloc_socket(__func__, sz,
+				RTE_CACHE_LINE_SIZE, tbl->socket_id)) == NULL) {
+			RTE_LOG(ERR, USER1,
+				"%s: allocation of %zu bytes at socket %d failed\n",
+				__func__, sz, tbl->socket_id);
+			return -ENOMEM;
+		}
+
+		tb->mask = prm->nb_bits - 1;
+		tb->cur = 0;
+		tb->start = 0;
+		tbl->mem_size += sz;
+	}
+
+	tb->period = (prm->ttl != 0) ? prm->ttl : tbl->max_cycles;
+	return 0;
+}
+
+/* configure memory budget of frag table */
+int
+rte_ip_frag_table_set_budget(struct rte_ip_frag_tbl *tbl,
+	const struct rte_ip_frag_budget_params *prm)
+{
+	if (prm == NULL) {
+		tbl->mem.max_bytes = UINT64_MAX;
+		tbl->mem.max_mbufs = UINT32_MAX;
+		return 0;
+	}
+
+	/* check input parameters. */
+	if (prm->policy > RTE_IP_FRAG_EVICT_EXPIRED) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	tbl->mem.max_bytes = (prm->max_bytes != 0) ?
+		prm->max_bytes : UINT64_MAX;
+	tbl->mem.max_mbufs = (prm->max_mbufs != 0) ?
+		prm->max_mbufs : UINT32_MAX;
+	tbl->mem.policy = prm->policy;
+	return 0;
+}
+
+/* select eviction policy for full frag table */
+int
+rte_ip_frag_table_set_evict(struct rte_ip_frag_tbl *tbl, uint32_t policy)
+{
+	if (policy > RTE_IP_FRAG_EVICT_EXPIRED) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	tbl->evict_policy = policy;
+	return 0;
+}
+
+/* restrict frag table to one address family */
+int
+rte_ip_frag_table_set_family(struct rte_ip_frag_tbl *tbl, uint32_t family)
+{
+	static const uint32_t key_len[] = {
+		[RTE_IP_FRAG_FAMILY_ANY] = 0,
+		[RTE_IP_FRAG_FAMILY_IPV4] = IPV4_KEYLEN,
+		[RTE_IP_FRAG_FAMILY_IPV6] = IPV6_KEYLEN,
+	};
+
+	if (family >= RTE_DIM(key_len)) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	/* entries have to be of the new family. */
+	if (tbl->use_entries != 0)
+		return -EBUSY;
+
+	tbl->key_len = key_len[family];
+	return 0;
+}
+
+/* copy fragments into one buffer per datagram, or chain them */
+int
+rte_ip_frag_table_set_copy(struct rte_ip_frag_tbl *tbl,
+	struct rte_mempool *pool)
+{
+	/* entries have to be reassembled the same way. */
+	if (tbl->use_entries != 0)
+		return -EBUSY;
+
+	tbl->copy_pool = pool;
+	return 0;
+}
+
+/* copy tiny fragments into tailroom of their neighbors */
+int
+rte_ip_frag_table_set_absorb(struct rte_ip_frag_tbl *tbl, uint32_t max_len)
+{
+	if (max_len > UINT16_MAX) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	tbl->absorb_len = max_len;
+	return 0;
+}
+
+/* select hash function of frag table */
+int
+rte_ip_frag_table_set_hash(struct rte_ip_frag_tbl *tbl,
+	const struct rte_ip_frag_hash_params *prm)
+{
+	uint32_t type;
+
+	type = (prm != NULL) ? prm->type : IP_FRAG_HASH_DEFAULT;
+
+	/* check input parameters. */
+	if (type > RTE_IP_FRAG_HASH_MULSHIFT) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+#ifndef RTE_MACHINE_CPUFLAG_SSE4_2
+	if (type == RTE_IP_FRAG_HASH_CRC)
+		return -ENOTSUP;
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+
+	/* entries have to stay in their buckets. */
+	if (tbl->use_entries != 0)
+		return -EBUSY;
+
+	tbl->hash.type = type;
+	ip_frag_hash_seed(&tbl->hash, (prm != NULL) ? prm->seed : 0);
+
+	/* recorded keys were hashed the old way. */
+	if (tbl->tomb.bits != NULL)
+		memset(tbl->tomb.bits, 0, 2 * (tbl->tomb.mask + 1) / 8);
+	return 0;
+}
+
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+/* keys hashed in parallel by CRC32 bulk hash */
+#define	IP_FRAG_HASH_CRC_LANES	4
+
+/*
+ * CRC32 hash of a burst of keys, IP_FRAG_HASH_CRC_LANES keys of the same
+ * length at once. Each CRC32 instruction depends on the previous one of
+ * its chain, so interleaving the chains of several keys keeps the CRC unit
+ * busy, instead of waiting for the result of each instruction.
+ */
+static void
+ip_frag_hash_crc_burst(const struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *keys, uint32_t num,
+	uint32_t *sig1, uint32_t *sig2)
+{
+	const struct ip_frag_tbl_hash *hs;
+	const uint32_t *p[IP_FRAG_HASH_CRC_LANES];
+	uint32_t i, j, k, n;
+	uint32_t v[IP_FRAG_HASH_CRC_LANES], w[IP_FRAG_HASH_CRC_LANES];
+
+	hs = &tbl->hash;
+
+	for (i = 0; i + IP_FRAG_HASH_CRC_LANES <= num;
+			i += IP_FRAG_HASH_CRC_LANES) {
+
+		n = keys[i].key_len;
+		for (k = 1; k != IP_FRAG_HASH_CRC_LANES &&
+				keys[i + k].key_len == n; k++)
+			;
+
+		/* mixed IPv4 and IPv6 keys, hash them one by one. */
+		if (k != IP_FRAG_HASH_CRC_LANES) {
+			for (k = 0; k != IP_FRAG_HASH_CRC_LANES; k++)
+				ip_frag_hash_crc(hs, keys + i + k, 0,
+					sig1 + i + k, sig2 + i + k);
+			continue;
+		}
+
+		n *= 2;
+		for (k = 0; k != IP_FRAG_HASH_CRC_LANES; k++) {
+			p[k] = (const uint32_t *)keys[i + k].src_dst;
+			v[k] = hs->seed[0];
+			w[k] = hs->seed[1];
+		}
+
+		for (j = 0; j != n; j++) {
+			for (k = 0; k != IP_FRAG_HASH_CRC_LANES; k++) {
+				v[k] = rte_hash_crc_4byte(p[k][j], v[k]);
+				w[k] = rte_hash_crc_4byte(p[k][n - j - 1], w[k]);
+			}
+		}
+
+		for (k = 0; k != IP_FRAG_HASH_CRC_LANES; k++) {
+			sig1[i + k] = rte_hash_crc_4byte(keys[i + k].id, v[k]);
+			sig2[i + k] = rte_hash_crc_4byte(keys[i + k].id, w[k]);
+		}
+	}
+
+	for (; i != num; i++)
+		ip_frag_hash_crc(hs, keys + i, 0, sig1 + i, sig2 + i);
+}
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+
+/*
+ * Multiply-shift hash of up to IP_FRAG_HASH_BURST keys, word by word
+ * over all keys, so that the inner loops have no branches.
+ */
+static void
+ip_frag_hash_mulshift_burst(const struct ip_frag_tbl_hash *hs,
+	const struct ip_frag_key *keys, uint32_t num,
+	uint32_t *sig1, uint32_t *sig2)
+{
+	uint32_t i, j, n, w;
+	uint64_t v1[IP_FRAG_HASH_BURST], v2[IP_FRAG_HASH_BURST];
+
+	n = 0;
+	for (i = 0; i != num; i++) {
+		v1[i] = hs->mul[0][IP_FRAG_HASH_WORDS] +
+			hs->mul[0][IP_FRAG_HASH_WORDS - 1] * keys[i].id;
+		v2[i] = hs->mul[1][IP_FRAG_HASH_WORDS] +
+			hs->mul[1][IP_FRAG_HASH_WORDS - 1] * keys[i].id;
+		n = RTE_MAX(n, 2 * keys[i].key_len);
+	}
+
+	/* words past the key length are skipped, as in the scalar hash. */
+	for (j = 0; j != n; j++) {
+		for (i = 0; i != num; i++) {
+			w = ((const uint32_t *)keys[i].src_dst)[j];
+			w = (j < 2 * keys[i].key_len) ? w : 0;
+			v1[i] += hs->mul[0][j] * w;
+			v2[i] += hs->mul[1][j] * w;
+		}
+	}
+
+	for (i = 0; i != num; i++) {
+		sig1[i] = v1[i] >> 32;
+		sig2[i] = v2[i] >> 32;
+	}
+}
+
+/* hash a burst of keys */
+void
+rte_ip_frag_hash_bulk(const struct rte_ip_frag_tbl *tbl,
+	const struct ip_frag_key *keys, uint32_t num,
+	uint32_t *sig1, uint32_t *sig2)
+{
+	uint32_t i, n;
+
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+	if (tbl->hash.type == RTE_IP_FRAG_HASH_CRC) {
+		ip_frag_hash_crc_burst(tbl, keys, num, sig1, sig2);
+		return;
+	}
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+
+	if (tbl->hash.type != RTE_IP_FRAG_HASH_MULSHIFT) {
+		for (i = 0; i != num; i++)
+			ip_frag_hash(tbl, keys + i, sig1 + i, sig2 + i);
+		return;
+	}
+
+	for (i = 0; i != num; i += n) {
+		n = RTE_MIN(num - i, (uint32_t)IP_FRAG_HASH_BURST);
+		ip_frag_hash_mulshift_burst(&tbl->hash, keys + i, n,
+			sig1 + i, sig2 + i);
+	}
+}
+
 /* dump frag table statistics to file */
 void
 rte_ip_frag_table_statistics_dump(FILE *f, const struct rte_ip_frag_tbl *tbl)
@@ -131,7 +674,23 @@ rte_ip_frag_table_statistics_dump(FILE *f, const struct rte_ip_frag_tbl *tbl)
 		"total add failures           :\t%" PRIu64 ";\n"
 		"add no-space failures        :\t%" PRIu64 ";\n"
 		"add hash-collisions failures :\t%" PRIu64 ";\n"
-		"mbuf in tbl                  :\t%" PRIu64 ";\n",
+		"mbuf in tbl                  :\t%" PRIu64 ";\n"
+		"overflow slot blocks in use  :\t%u of %u;\n"
+		"overflow slot failures       :\t%" PRIu64 ";\n"
+		"table memory at socket %-6d:\t%zu bytes;\n"
+		"mbufs from other sockets     :\t%" PRIu64 ";\n"
+		"table size (entries)         :\t%u%s;\n"
+		"table grows/shrinks          :\t%" PRIu64 "/%" PRIu64 ";\n"
+		"entries migrated/dropped     :\t%" PRIu64 "/%" PRIu64 ";\n"
+		"fragments over source quota  :\t%" PRIu64 ";\n"
+		"buffered bytes/mbufs         :\t%" PRIu64 "/%u;\n"
+		"budget evictions/drops       :\t%" PRIu64 "/%" PRIu64 ";\n"
+		"live entries evicted on full :\t%" PRIu64 ";\n"
+		"lookup cache hits            :\t%" PRIu64 ";\n"
+		"datagrams done within burst  :\t%" PRIu64 ";\n"
+		"fragments failed to copy     :\t%" PRIu64 ";\n"
+		"tiny fragments absorbed      :\t%" PRIu64 ";\n"
+		"late fragments dropped       :\t%" PRIu64 ";\n",
 		tbl->max_entries,
 		tbl->use_entries,
 		tbl->stat.find_num,
@@ -141,7 +700,24 @@ rte_ip_frag_table_statistics_dump(FILE *f, const struct rte_ip_frag_tbl *tbl)
 		fail_total,
 		fail_nospace,
 		fail_total - fail_nospace,
-		tbl->stat.mbuf_num);
+		tbl->stat.mbuf_num,
+		tbl->use_ext, tbl->nb_ext,
+		tbl->stat.fail_noslot,
+		tbl->socket_id, tbl->mem_size,
+		tbl->stat.xsocket_num,
+		tbl->nb_entries,
+		(tbl->resize.old != NULL) ? " (resizing)" : "",
+		tbl->stat.grow_num, tbl->stat.shrink_num,
+		tbl->stat.mig_num, tbl->stat.mig_drop,
+		tbl->stat.fail_quota,
+		tbl->mem.bytes, tbl->mem.mbufs,
+		tbl->stat.evict_num, tbl->stat.fail_budget,
+		tbl->stat.evict_full,
+		tbl->stat.cache_hit,
+		tbl->stat.burst_num,
+		tbl->stat.fail_copy,
+		tbl->stat.absorb_num,
+		tbl->stat.tomb_drop);
 }
 
 /* check LRU entry and move to death row if expired */
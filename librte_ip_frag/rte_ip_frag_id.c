@@ -0,0 +1,170 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2010-2014 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <rte_memory.h>
+#include <rte_log.h>
+#include <rte_lcore.h>
+#include <rte_per_lcore.h>
+#include <rte_atomic.h>
+#include <rte_random.h>
+#include <rte_memcpy.h>
+#include <rte_jhash.h>
+#ifdef RTE_MACHINE_CPUFLAG_SSE4_2
+#include <rte_hash_crc.h>
+#endif /* RTE_MACHINE_CPUFLAG_SSE4_2 */
+
+#include "ip_frag_common.h"
+
+/*
+ * Per-lcore sequential identification counter.
+ * Each lcore starts from a random value, so that counters of
+ * different lcores do not run in lockstep for the same destination.
+ */
+static RTE_DEFINE_PER_LCORE(uint32_t, ip_frag_id_next);
+static RTE_DEFINE_PER_LCORE(uint32_t, ip_frag_id_seeded);
+
+/* fragment identification generator */
+struct rte_ip_frag_id_gen {
+	enum rte_ip_frag_id_mode mode;  /**< generation mode. */
+	uint32_t counter_mask;          /**< counter array mask. */
+	uint32_t secret[2];             /**< per-generator hash keys. */
+	rte_atomic32_t counter[0];      /**< per-destination counters. */
+} __rte_cache_aligned;
+
+static inline uint32_t
+ip_frag_id_lcore_next(void)
+{
+	if (unlikely(RTE_PER_LCORE(ip_frag_id_seeded) == 0)) {
+		RTE_PER_LCORE(ip_frag_id_next) = (uint32_t)rte_rand();
+		RTE_PER_LCORE(ip_frag_id_seeded) = 1;
+	}
+	return RTE_PER_LCORE(ip_frag_id_next)++;
+}
+
+/*
+ * RFC 7739, section 5.3: the identification is the sum of a keyed hash
+ * over <src, dst> and a counter selected by another keyed hash of the same
+ * tuple. Destinations sharing a counter still see unrelated sequences,
+ * and only an atomic increment is needed on the fast path.
+ */
+static inline uint32_t
+ip_frag_id_dst_next(struct rte_ip_frag_id_gen *gen, const uint32_t *src,
+	const uint32_t *dst, uint32_t words)
+{
+	uint32_t idx, ofs;
+
+	ofs = ip_frag_addr_hash(dst, words,
+		ip_frag_addr_hash(src, words, gen->secret[0]));
+	idx = ip_frag_addr_hash(dst, words,
+		ip_frag_addr_hash(src, words, gen->secret[1]));
+
+	return ofs + (uint32_t)rte_atomic32_add_return(
+		&gen->counter[idx & gen->counter_mask], 1);
+}
+
+static inline uint32_t
+ip_frag_id_next(struct rte_ip_frag_id_gen *gen, const uint32_t *src,
+	const uint32_t *dst, uint32_t words)
+{
+	if (gen == NULL)
+		return ip_frag_id_lcore_next();
+
+	switch (gen->mode) {
+	case RTE_IP_FRAG_ID_PER_DST:
+		return ip_frag_id_dst_next(gen, src, dst, words);
+	case RTE_IP_FRAG_ID_RANDOM:
+		return (uint32_t)rte_rand();
+	case RTE_IP_FRAG_ID_PER_LCORE:
+	default:
+		return ip_frag_id_lcore_next();
+	}
+}
+
+/* create fragment identification generator */
+struct rte_ip_frag_id_gen *
+rte_ip_frag_id_gen_create(enum rte_ip_frag_id_mode mode, uint32_t nb_counters,
+	int socket_id)
+{
+	struct rte_ip_frag_id_gen *gen;
+	size_t sz;
+
+	if (mode != RTE_IP_FRAG_ID_PER_DST)
+		nb_counters = 0;
+	else if (nb_counters == 0 || nb_counters > (UINT32_MAX >> 1)) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return NULL;
+	} else
+		nb_counters = rte_align32pow2(nb_counters);
+
+	sz = sizeof(*gen) + nb_counters * sizeof(gen->counter[0]);
+	if ((gen = rte_zmalloc_socket(__func__, sz, RTE_CACHE_LINE_SIZE,
+			socket_id)) == NULL) {
+		RTE_LOG(ERR, USER1,
+			"%s: allocation of %zu bytes at socket %d failed\n",
+			__func__, sz, socket_id);
+		return NULL;
+	}
+
+	gen->mode = mode;
+	gen->counter_mask = (nb_counters != 0) ? nb_counters - 1 : 0;
+	gen->secret[0] = (uint32_t)rte_rand();
+	gen->secret[1] = (uint32_t)rte_rand();
+	return gen;
+}
+
+/* get identification for the next fragmented IPv4 datagram */
+uint16_t
+rte_ipv4_frag_id_next(struct rte_ip_frag_id_gen *gen,
+	const struct ipv4_hdr *hdr)
+{
+	uint32_t src, dst;
+
+	src = hdr->src_addr;
+	dst = hdr->dst_addr;
+	return (uint16_t)ip_frag_id_next(gen, &src, &dst, 1);
+}
+
+/* get identification for the next fragmented IPv6 datagram */
+uint32_t
+rte_ipv6_frag_id_next(struct rte_ip_frag_id_gen *gen,
+	const struct ipv6_hdr *hdr)
+{
+	uint32_t src[4], dst[4];
+
+	rte_memcpy(src, hdr->src_addr, sizeof(src));
+	rte_memcpy(dst, hdr->dst_addr, sizeof(dst));
+	return ip_frag_id_next(gen, src, dst, RTE_DIM(src));
+}
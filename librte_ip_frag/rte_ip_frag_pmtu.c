@@ -0,0 +1,398 @@
+/*-
+ *   BSD LICENSE
+ *
+ *   Copyright(c) 2010-2014 Intel Corporation. All rights reserved.
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_memory.h>
+#include <rte_log.h>
+#include <rte_atomic.h>
+#include <rte_random.h>
+#include <rte_prefetch.h>
+#include <rte_memcpy.h>
+
+#include "ip_frag_common.h"
+
+/* entries per bucket, a bucket takes two cache lines. */
+#define	IP_FRAG_PMTU_BUCKET	4
+
+/* address words of IPv4 and IPv6 destinations. */
+#define	IP_FRAG_PMTU_V4		1
+#define	IP_FRAG_PMTU_V6		4
+
+/* lowest MTU an ICMP report may set, RFC 791 and RFC 8200. */
+#define	IP_FRAG_PMTU_MIN_V4	68
+#define	IP_FRAG_PMTU_MIN_V6	1280
+
+/* ICMP destination unreachable, fragmentation needed. */
+#define	IP_FRAG_ICMP_UNREACH	3
+#define	IP_FRAG_ICMP_FRAG_NEEDED	4
+
+/* ICMPv6 packet too big. */
+#define	IP_FRAG_ICMP6_TOO_BIG	2
+
+/*
+ * PMTU cache entry. Writers make seq odd while they change the entry,
+ * readers take no lock and drop what they read if seq was odd or
+ * has changed meanwhile.
+ */
+struct ip_frag_pmtu_entry {
+	volatile uint32_t seq;          /**< odd while being written. */
+	uint16_t mtu;                   /**< path MTU. */
+	uint16_t key_len;               /**< address words, 0 - empty. */
+	uint64_t start;                 /**< TSC the entry was set at. */
+	uint32_t dst[IP_FRAG_PMTU_V6];  /**< destination address. */
+};
+
+struct ip_frag_pmtu_bkt {
+	struct ip_frag_pmtu_entry ent[IP_FRAG_PMTU_BUCKET];
+} __rte_cache_aligned;
+
+/* per-destination path MTU cache */
+struct rte_ip_frag_pmtu {
+	uint32_t bucket_mask;           /**< bucket array mask. */
+	uint32_t secret;                /**< hash key. */
+	uint64_t ttl;                   /**< entry lifetime, 0 - forever. */
+	struct ip_frag_pmtu_bkt bkt[0]; /**< buckets. */
+} __rte_cache_aligned;
+
+static inline uint32_t
+ip_frag_pmtu_idx(const struct rte_ip_frag_pmtu *pc, const uint32_t *dst,
+	uint32_t words)
+{
+	return ip_frag_addr_hash(dst, words, pc->secret) & pc->bucket_mask;
+}
+
+/* entry is not expired yet */
+static inline int
+ip_frag_pmtu_live(const struct rte_ip_frag_pmtu *pc,
+	const struct ip_frag_pmtu_entry *e, uint64_t tms)
+{
+	return pc->ttl == 0 || tms < e->start + pc->ttl;
+}
+
+static inline int
+ip_frag_pmtu_match(const struct ip_frag_pmtu_entry *e, const uint32_t *dst,
+	uint32_t words)
+{
+	return e->key_len == words &&
+		memcmp(e->dst, dst, words * sizeof(dst[0])) == 0;
+}
+
+/* lowest live MTU cached for dst, 0 if there is none. */
+static inline uint16_t
+ip_frag_pmtu_find(const struct rte_ip_frag_pmtu *pc,
+	const struct ip_frag_pmtu_bkt *bkt, const uint32_t *dst,
+	uint32_t words, uint64_t tms)
+{
+	const struct ip_frag_pmtu_entry *e;
+	uint32_t i, seq, hit;
+	uint16_t mtu, res;
+
+	res = 0;
+	for (i = 0; i != RTE_DIM(bkt->ent); i++) {
+		e = bkt->ent + i;
+
+		seq = e->seq;
+		rte_rmb();
+		hit = ip_frag_pmtu_match(e, dst, words) &&
+			ip_frag_pmtu_live(pc, e, tms);
+		mtu = e->mtu;
+		rte_rmb();
+
+		/* written meanwhile, what we read can be torn. */
+		if (hit == 0 || (seq & 1) != 0 || e->seq != seq)
+			continue;
+		if (res == 0 || mtu < res)
+			res = mtu;
+	}
+
+	return res;
+}
+
+/*
+ * rewrite entry, mtu 0 empties it.
+ * Concurrent writers of the same entry don't wait, all but one fail.
+ */
+static inline int
+ip_frag_pmtu_write(struct ip_frag_pmtu_entry *e, const uint32_t *dst,
+	uint32_t words, uint16_t mtu, uint64_t tms)
+{
+	uint32_t seq;
+
+	seq = e->seq;
+	if ((seq & 1) != 0 || rte_atomic32_cmpset(&e->seq, seq, seq + 1) == 0)
+		return -EBUSY;
+
+	e->key_len = (uint16_t)((mtu != 0) ? words : 0);
+	e->mtu = mtu;
+	e->start = tms;
+	rte_memcpy(e->dst, dst, words * sizeof(dst[0]));
+
+	rte_wmb();
+	e->seq = seq + 2;
+	return 0;
+}
+
+/*
+ * set MTU for dst, mtu 0 removes it.
+ * With lower set, only a lower MTU replaces a live one, so that
+ * ICMP reports can't raise the PMTU before the entry expires.
+ */
+static int
+ip_frag_pmtu_set(struct rte_ip_frag_pmtu *pc, const uint32_t *dst,
+	uint32_t words, uint16_t mtu, uint64_t tms, int lower)
+{
+	struct ip_frag_pmtu_bkt *bkt;
+	struct ip_frag_pmtu_entry *e, *victim;
+	uint32_t i, found;
+	int ret;
+
+	bkt = pc->bkt + ip_frag_pmtu_idx(pc, dst, words);
+	victim = NULL;
+	found = 0;
+	ret = 0;
+
+	/* racing writers may have cached dst twice, update all copies. */
+	for (i = 0; i != RTE_DIM(bkt->ent); i++) {
+		e = bkt->ent + i;
+		if (ip_frag_pmtu_match(e, dst, words)) {
+			found = 1;
+			if ((lower == 0 || mtu < e->mtu ||
+					ip_frag_pmtu_live(pc, e, tms) == 0) &&
+					ip_frag_pmtu_write(e, dst, words, mtu,
+					tms) != 0)
+				ret = -EBUSY;
+
+		/* empty or expired first, then the one set first. */
+		} else if (victim == NULL || (victim->key_len != 0 &&
+				ip_frag_pmtu_live(pc, victim, tms) &&
+				(e->key_len == 0 || ip_frag_pmtu_live(pc, e,
+				tms) == 0 || e->start < victim->start)))
+			victim = e;
+	}
+
+	if (found == 0 && mtu != 0)
+		ret = ip_frag_pmtu_write(victim, dst, words, mtu, tms);
+
+	return ret;
+}
+
+/* look up to IP_FRAG_HASH_BURST destinations, buckets are prefetched first. */
+static inline uint32_t
+ip_frag_pmtu_burst(const struct rte_ip_frag_pmtu *pc,
+	const uint32_t dst[][IP_FRAG_PMTU_V6], uint32_t words, uint32_t num,
+	uint16_t mtu_size, uint16_t mtu[], uint64_t tms)
+{
+	const struct ip_frag_pmtu_bkt *bkt[IP_FRAG_HASH_BURST];
+	uint32_t i, n;
+	uint16_t m;
+
+	for (i = 0; i != num; i++) {
+		bkt[i] = pc->bkt + ip_frag_pmtu_idx(pc, dst[i], words);
+		rte_prefetch0(bkt[i]);
+		rte_prefetch0((const char *)bkt[i] + RTE_CACHE_LINE_SIZE);
+	}
+
+	n = 0;
+	for (i = 0; i != num; i++) {
+		m = ip_frag_pmtu_find(pc, bkt[i], dst[i], words, tms);
+		n += (m != 0);
+		mtu[i] = (m != 0 && m < mtu_size) ? m : mtu_size;
+	}
+
+	return n;
+}
+
+/* create path MTU cache */
+struct rte_ip_frag_pmtu *
+rte_ip_frag_pmtu_create(uint32_t nb_entries, uint64_t ttl, int socket_id)
+{
+	struct rte_ip_frag_pmtu *pc;
+	uint32_t nb_bkt;
+	size_t sz;
+
+	if (nb_entries == 0 || nb_entries > (UINT32_MAX >> 1)) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return NULL;
+	}
+
+	nb_bkt = rte_align32pow2((nb_entries + IP_FRAG_PMTU_BUCKET - 1) /
+		IP_FRAG_PMTU_BUCKET);
+
+	sz = sizeof(*pc) + nb_bkt * sizeof(pc->bkt[0]);
+	if ((pc = rte_zmalloc_socket(__func__, sz, RTE_CACHE_LINE_SIZE,
+			socket_id)) == NULL) {
+		RTE_LOG(ERR, USER1,
+			"%s: allocation of %zu bytes at socket %d failed\n",
+			__func__, sz, socket_id);
+		return NULL;
+	}
+
+	pc->bucket_mask = nb_bkt - 1;
+	pc->secret = (uint32_t)rte_rand();
+	pc->ttl = ttl;
+	return pc;
+}
+
+/* set path MTU towards IPv4 destination */
+int
+rte_ipv4_frag_pmtu_update(struct rte_ip_frag_pmtu *pc, uint32_t dst_addr,
+	uint16_t mtu, uint64_t tms)
+{
+	if (pc == NULL) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	return ip_frag_pmtu_set(pc, &dst_addr, IP_FRAG_PMTU_V4, mtu, tms, 0);
+}
+
+/* set path MTU towards IPv6 destination */
+int
+rte_ipv6_frag_pmtu_update(struct rte_ip_frag_pmtu *pc,
+	const uint8_t dst_addr[], uint16_t mtu, uint64_t tms)
+{
+	uint32_t dst[IP_FRAG_PMTU_V6];
+
+	if (pc == NULL || dst_addr == NULL) {
+		RTE_LOG(ERR, USER1, "%s: invalid input parameter\n", __func__);
+		return -EINVAL;
+	}
+
+	rte_memcpy(dst, dst_addr, sizeof(dst));
+	return ip_frag_pmtu_set(pc, dst, IP_FRAG_PMTU_V6, mtu, tms, 0);
+}
+
+/* learn path MTU from ICMP fragmentation needed (RFC 1191) */
+int
+rte_ipv4_frag_pmtu_icmp(struct rte_ip_frag_pmtu *pc, const void *icmp,
+	uint32_t len, uint64_t tms)
+{
+	const uint8_t *p;
+	struct ipv4_hdr ip;
+	uint32_t dst;
+	uint16_t mtu;
+
+	p = icmp;
+	if (len < 8 + sizeof(ip) || p[0] != IP_FRAG_ICMP_UNREACH ||
+			p[1] != IP_FRAG_ICMP_FRAG_NEEDED)
+		return -EINVAL;
+
+	/* header of the dropped packet follows the ICMP header. */
+	rte_memcpy(&ip, p + 8, sizeof(ip));
+	mtu = (uint16_t)(p[6] << 8 | p[7]);
+
+	/* no next-hop MTU, or not below the size of the dropped packet. */
+	if (mtu < IP_FRAG_PMTU_MIN_V4 ||
+			mtu >= rte_be_to_cpu_16(ip.total_length))
+		return -EINVAL;
+
+	dst = ip.dst_addr;
+	return ip_frag_pmtu_set(pc, &dst, IP_FRAG_PMTU_V4, mtu, tms, 1);
+}
+
+/* learn path MTU from ICMPv6 packet too big (RFC 8201) */
+int
+rte_ipv6_frag_pmtu_icmp(struct rte_ip_frag_pmtu *pc, const void *icmp,
+	uint32_t len, uint64_t tms)
+{
+	const uint8_t *p;
+	struct ipv6_hdr ip;
+	uint32_t dst[IP_FRAG_PMTU_V6], mtu;
+
+	p = icmp;
+	if (len < 8 + sizeof(ip) || p[0] != IP_FRAG_ICMP6_TOO_BIG ||
+			p[1] != 0)
+		return -EINVAL;
+
+	rte_memcpy(&ip, p + 8, sizeof(ip));
+	mtu = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+
+	if (mtu >= sizeof(ip) + rte_be_to_cpu_16(ip.payload_len))
+		return -EINVAL;
+
+	/* below the IPv6 minimum, the minimum is used, above 16 bits the max. */
+	mtu = RTE_MAX(mtu, (uint32_t)IP_FRAG_PMTU_MIN_V6);
+	mtu = RTE_MIN(mtu, (uint32_t)UINT16_MAX);
+
+	rte_memcpy(dst, ip.dst_addr, sizeof(dst));
+	return ip_frag_pmtu_set(pc, dst, IP_FRAG_PMTU_V6, (uint16_t)mtu, tms,
+		1);
+}
+
+/* get path MTUs for a burst of IPv4 packets */
+uint32_t
+rte_ipv4_frag_pmtu_lookup_bulk(const struct rte_ip_frag_pmtu *pc,
+	struct rte_mbuf *mb[], uint32_t num, uint16_t mtu_size,
+	uint16_t mtu[], uint64_t tms)
+{
+	uint32_t dst[IP_FRAG_HASH_BURST][IP_FRAG_PMTU_V6];
+	uint32_t i, j, n, hit;
+
+	hit = 0;
+	for (i = 0; i < num; i += n) {
+		n = RTE_MIN(num - i, (uint32_t)IP_FRAG_HASH_BURST);
+		for (j = 0; j != n; j++)
+			dst[j][0] = rte_pktmbuf_mtod(mb[i + j],
+				const struct ipv4_hdr *)->dst_addr;
+		hit += ip_frag_pmtu_burst(pc, dst, IP_FRAG_PMTU_V4, n,
+			mtu_size, mtu + i, tms);
+	}
+
+	return hit;
+}
+
+/* get path MTUs for a burst of IPv6 packets */
+uint32_t
+rte_ipv6_frag_pmtu_lookup_bulk(const struct rte_ip_frag_pmtu *pc,
+	struct rte_mbuf *mb[], uint32_t num, uint16_t mtu_size,
+	uint16_t mtu[], uint64_t tms)
+{
+	uint32_t dst[IP_FRAG_HASH_BURST][IP_FRAG_PMTU_V6];
+	uint32_t i, j, n, hit;
+
+	hit = 0;
+	for (i = 0; i < num; i += n) {
+		n = RTE_MIN(num - i, (uint32_t)IP_FRAG_HASH_BURST);
+		for (j = 0; j != n; j++)
+			rte_memcpy(dst[j], rte_pktmbuf_mtod(mb[i + j],
+				const struct ipv6_hdr *)->dst_addr,
+				sizeof(dst[j]));
+		hit += ip_frag_pmtu_burst(pc, dst, IP_FRAG_PMTU_V6, n,
+			mtu_size, mtu + i, tms);
+	}
+
+	return hit;
+}
@@ -52,9 +52,10 @@
 
 static inline void __fill_ipv4hdr_frag(struct ipv4_hdr *dst,
 		const struct ipv4_hdr *src, uint16_t len, uint16_t fofs,
-		uint16_t dofs, uint32_t mf)
+		uint16_t dofs, uint32_t mf, uint16_t id)
 {
 	rte_memcpy(dst, src, sizeof(*dst));
+	dst->packet_id = id;
 	fofs = (uint16_t)(fofs + (dofs >> IPV4_HDR_FO_SHIFT));
 	fofs = (uint16_t)(fofs | mf << IPV4_HDR_MF_SHIFT);
 	dst->fragment_offset = rte_cpu_to_be_16(fofs);
@@ -69,47 +70,18 @@ static inline void __free_fragments(struct rte_mbuf *mb[], uint32_t num)
 		rte_pktmbuf_free(mb[i]);
 }
 
-/**
- * IPv4 fragmentation.
- *
- * This function implements the fragmentation of IPv4 packets.
- *
- * @param pkt_in
- *   The input packet.
- * @param pkts_out
- *   Array storing the output fragments.
- * @param mtu_size
- *   Size in bytes of the Maximum Transfer Unit (MTU) for the outgoing IPv4
- *   datagrams. This value includes the size of the IPv4 header.
- * @param pool_direct
- *   MBUF pool used for allocating direct buffers for the output fragments.
- * @param pool_indirect
- *   MBUF pool used for allocating indirect buffers for the output fragments.
- * @return
- *   Upon successful completion - number of output fragments placed
- *   in the pkts_out array.
- *   Otherwise - (-1) * <errno>.
- */
-int32_t
-rte_ipv4_fragment_packet(struct rte_mbuf *pkt_in,
-	struct rte_mbuf **pkts_out,
-	uint16_t nb_pkts_out,
-	uint16_t mtu_size,
-	struct rte_mempool *pool_direct,
-	struct rte_mempool *pool_indirect)
+/* check that the packet may be split into at most nb_pkts_out fragments */
+static inline int32_t
+__ipv4_fragment_check(const struct rte_mbuf *pkt_in, uint16_t nb_pkts_out,
+	uint16_t mtu_size, const struct ipv4_hdr *in_hdr)
 {
-	struct rte_mbuf *in_seg = NULL;
-	struct ipv4_hdr *in_hdr;
-	uint32_t out_pkt_pos, in_seg_data_pos;
-	uint32_t more_in_segs;
-	uint16_t fragment_offset, flag_offset, frag_size;
+	uint16_t flag_offset, frag_size;
 
 	frag_size = (uint16_t)(mtu_size - sizeof(struct ipv4_hdr));
 
 	/* Fragment size should be a multiply of 8. */
 	IP_FRAG_ASSERT((frag_size & IPV4_HDR_FO_MASK) == 0);
 
-	in_hdr = rte_pktmbuf_mtod(pkt_in, struct ipv4_hdr *);
 	flag_offset = rte_cpu_to_be_16(in_hdr->fragment_offset);
 
 	/* If Don't Fragment flag is set */
@@ -121,11 +93,36 @@ rte_ipv4_fragment_packet(struct rte_mbuf *pkt_in,
 	    (uint16_t)(pkt_in->pkt_len - sizeof (struct ipv4_hdr))))
 		return -EINVAL;
 
+	return 0;
+}
+
+static inline int32_t
+__ipv4_fragment_packet(struct rte_mbuf *pkt_in,
+	struct rte_mbuf **pkts_out,
+	uint16_t nb_pkts_out,
+	uint16_t mtu_size,
+	struct rte_mempool *pool_direct,
+	struct rte_mempool *pool_indirect,
+	struct ipv4_hdr *in_hdr, uint16_t packet_id)
+{
+	struct rte_mbuf *in_seg = NULL;
+	uint32_t out_pkt_pos, in_seg_data_pos;
+	uint32_t more_in_segs;
+	uint16_t fragment_offset, flag_offset;
+
+	flag_offset = rte_cpu_to_be_16(in_hdr->fragment_offset);
+
 	in_seg = pkt_in;
 	in_seg_data_pos = sizeof(struct ipv4_hdr);
 	out_pkt_pos = 0;
 	fragment_offset = 0;
 
+	/* skip segments holding nothing but the header */
+	while (in_seg_data_pos == in_seg->data_len && in_seg->next != NULL) {
+		in_seg = in_seg->next;
+		in_seg_data_pos = 0;
+	}
+
 	more_in_segs = 1;
 	while (likely(more_in_segs)) {
 		struct rte_mbuf *out_pkt = NULL, *out_seg_prev = NULL;
@@ -162,7 +159,7 @@ rte_ipv4_fragment_packet(struct rte_mbuf *pkt_in,
 			out_seg_prev = out_seg;
 
 			/* Prepare indirect buffer */
-			rte_pktmbuf_attach(out_seg, in_seg);
+			rte_pktmbuf_attach(out_seg, ip_frag_direct(in_seg));
 			len = mtu_size - out_pkt->pkt_len;
 			if (len > (in_seg->data_len - in_seg_data_pos)) {
 				len = in_seg->data_len - in_seg_data_pos;
@@ -194,7 +191,7 @@ rte_ipv4_fragment_packet(struct rte_mbuf *pkt_in,
 
 		__fill_ipv4hdr_frag(out_hdr, in_hdr,
 		    (uint16_t)out_pkt->pkt_len,
-		    flag_offset, fragment_offset, more_in_segs);
+		    flag_offset, fragment_offset, more_in_segs, packet_id);
 
 		fragment_offset = (uint16_t)(fragment_offset +
 		    out_pkt->pkt_len - sizeof(struct ipv4_hdr));
@@ -209,3 +206,158 @@ rte_ipv4_fragment_packet(struct rte_mbuf *pkt_in,
 
 	return out_pkt_pos;
 }
+
+/**
+ * IPv4 fragmentation.
+ *
+ * This function implements the fragmentation of IPv4 packets.
+ *
+ * @param pkt_in
+ *   The input packet.
+ * @param pkts_out
+ *   Array storing the output fragments.
+ * @param mtu_size
+ *   Size in bytes of the Maximum Transfer Unit (MTU) for the outgoing IPv4
+ *   datagrams. This value includes the size of the IPv4 header.
+ * @param pool_direct
+ *   MBUF pool used for allocating direct buffers for the output fragments.
+ * @param pool_indirect
+ *   MBUF pool used for allocating indirect buffers for the output fragments.
+ * @return
+ *   Upon successful completion - number of output fragments placed
+ *   in the pkts_out array.
+ *   Otherwise - (-1) * <errno>.
+ */
+int32_t
+rte_ipv4_fragment_packet(struct rte_mbuf *pkt_in,
+	struct rte_mbuf **pkts_out,
+	uint16_t nb_pkts_out,
+	uint16_t mtu_size,
+	struct rte_mempool *pool_direct,
+	struct rte_mempool *pool_indirect)
+{
+	struct ipv4_hdr *in_hdr;
+	int32_t ret;
+
+	in_hdr = rte_pktmbuf_mtod(pkt_in, struct ipv4_hdr *);
+	ret = __ipv4_fragment_check(pkt_in, nb_pkts_out, mtu_size, in_hdr);
+	if (unlikely(ret != 0))
+		return ret;
+
+	return __ipv4_fragment_packet(pkt_in, pkts_out, nb_pkts_out, mtu_size,
+		pool_direct, pool_indirect, in_hdr, in_hdr->packet_id);
+}
+
+int32_t
+rte_ipv4_fragment_packet_idgen(struct rte_mbuf *pkt_in,
+	struct rte_mbuf **pkts_out,
+	uint16_t nb_pkts_out,
+	uint16_t mtu_size,
+	struct rte_mempool *pool_direct,
+	struct rte_mempool *pool_indirect,
+	struct rte_ip_frag_id_gen *id_gen)
+{
+	struct ipv4_hdr *in_hdr;
+	uint16_t flag_offset, packet_id;
+	int32_t ret;
+
+	in_hdr = rte_pktmbuf_mtod(pkt_in, struct ipv4_hdr *);
+	flag_offset = rte_cpu_to_be_16(in_hdr->fragment_offset);
+
+	/* a fragment keeps the identification of its datagram */
+	if (unlikely((flag_offset &
+			(IPV4_HDR_MF_FLAG | IPV4_HDR_OFFSET_MASK)) != 0))
+		return -EINVAL;
+
+	/* take an identification only for a packet that will be split */
+	ret = __ipv4_fragment_check(pkt_in, nb_pkts_out, mtu_size, in_hdr);
+	if (unlikely(ret != 0))
+		return ret;
+
+	packet_id = rte_cpu_to_be_16(rte_ipv4_frag_id_next(id_gen, in_hdr));
+
+	return __ipv4_fragment_packet(pkt_in, pkts_out, nb_pkts_out, mtu_size,
+		pool_direct, pool_indirect, in_hdr, packet_id);
+}
+
+/**
+ * IPv4 refragmentation.
+ *
+ * Splits an IPv4 fragment (or a whole datagram) to fit the egress MTU,
+ * without reassembly: every output fragment keeps the identification
+ * of the input, its offset is relative to the input's offset and
+ * the last one keeps the input's MF flag.
+ * A packet that already fits is passed through untouched.
+ *
+ * @param pkt_in
+ *   The input fragment, consumed on success.
+ * @param pkts_out
+ *   Array storing the output fragments.
+ * @param nb_pkts_out
+ *   Number of entries in pkts_out.
+ * @param mtu_size
+ *   Size in bytes of the egress MTU, including the IPv4 header,
+ *   the fragment payload is rounded down to a multiple of 8.
+ * @param pool_direct
+ *   MBUF pool used for allocating direct buffers for the output fragments.
+ * @param pool_indirect
+ *   MBUF pool used for allocating indirect buffers for the output fragments.
+ * @return
+ *   Upon successful completion - number of output fragments placed
+ *   in the pkts_out array.
+ *   Otherwise - (-1) * <errno>.
+ */
+int32_t
+rte_ipv4_refragment_packet(struct rte_mbuf *pkt_in,
+	struct rte_mbuf **pkts_out,
+	uint16_t nb_pkts_out,
+	uint16_t mtu_size,
+	struct rte_mempool *pool_direct,
+	struct rte_mempool *pool_indirect)
+{
+	struct ipv4_hdr *in_hdr;
+	int32_t ret;
+
+	if (unlikely(nb_pkts_out == 0))
+		return -EINVAL;
+
+	/* fits already, nothing to do */
+	if (pkt_in->pkt_len <= mtu_size) {
+		pkts_out[0] = pkt_in;
+		return 1;
+	}
+
+	if (unlikely(mtu_size < sizeof(struct ipv4_hdr) +
+			(1 << IPV4_HDR_FO_SHIFT)))
+		return -EINVAL;
+
+	mtu_size = (uint16_t)(mtu_size -
+		((mtu_size - sizeof(struct ipv4_hdr)) & IPV4_HDR_FO_MASK));
+
+	/* offset and MF of the input carry over into the fragments. */
+	in_hdr = rte_pktmbuf_mtod(pkt_in, struct ipv4_hdr *);
+	ret = __ipv4_fragment_check(pkt_in, nb_pkts_out, mtu_size, in_hdr);
+	if (unlikely(ret != 0))
+		return ret;
+
+	ret = __ipv4_fragment_packet(pkt_in, pkts_out, nb_pkts_out, mtu_size,
+		pool_direct, pool_indirect, in_hdr, in_hdr->packet_id);
+
+	/* fragments hold their own references to the data. */
+	if (ret > 0)
+		rte_pktmbuf_free(pkt_in);
+	return ret;
+}
+
+uint16_t
+rte_ipv4_frag_size_mtu(const struct rte_mbuf *pkt_in, uint16_t mtu_size,
+	enum rte_ip_frag_size_mode mode, uint16_t buf_size)
+{
+	/* fits, nothing to size. */
+	if (pkt_in->pkt_len <= mtu_size)
+		return mtu_size;
+
+	return ip_frag_size_mtu(mode, buf_size, mtu_size,
+		sizeof(struct ipv4_hdr),
+		pkt_in->pkt_len - sizeof(struct ipv4_hdr));
+}
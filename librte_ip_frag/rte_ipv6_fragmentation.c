@@ -55,7 +55,7 @@
 static inline void
 __fill_ipv6hdr_frag(struct ipv6_hdr *dst,
 		const struct ipv6_hdr *src, uint16_t len, uint16_t fofs,
-		uint32_t mf)
+		uint32_t mf, uint8_t proto, uint32_t id)
 {
 	struct ipv6_extension_fragment *fh;
 
@@ -63,13 +63,13 @@ __fill_ipv6hdr_frag(struct ipv6_hdr *dst,
 	dst->payload_len = rte_cpu_to_be_16(len);
 	dst->proto = IPPROTO_FRAGMENT;
 
+	/* fofs is in bytes, i.e. already shifted into place. */
 	fh = (struct ipv6_extension_fragment *) ++dst;
-	fh->next_header = src->proto;
+	fh->next_header = proto;
 	fh->reserved1   = 0;
-	fh->frag_offset = rte_cpu_to_be_16(fofs);
-	fh->reserved2   = 0;
-	fh->more_frags  = rte_cpu_to_be_16(mf);
-	fh->id = 0;
+	fh->frag_data   = rte_cpu_to_be_16((fofs & ~IPV6_HDR_FO_MASK) |
+		(mf << IPV6_HDR_MF_SHIFT));
+	fh->id = id;
 }
 
 static inline void
@@ -109,28 +109,70 @@ rte_ipv6_fragment_packet(struct rte_mbuf *pkt_in,
 	struct rte_mempool *pool_direct,
 	struct rte_mempool *pool_indirect)
 {
-	struct rte_mbuf *in_seg = NULL;
-	struct ipv6_hdr *in_hdr;
-	uint32_t out_pkt_pos, in_seg_data_pos;
-	uint32_t more_in_segs;
-	uint16_t fragment_offset, frag_size;
+	return rte_ipv6_fragment_packet_idgen(pkt_in, pkts_out, nb_pkts_out,
+		mtu_size, pool_direct, pool_indirect, NULL);
+}
+
+/*
+ * check that the payload of pkt_in, after in_hlen bytes of headers,
+ * may be split into at most nb_pkts_out fragments.
+ */
+static inline int32_t
+__ipv6_fragment_check(const struct rte_mbuf *pkt_in, uint16_t nb_pkts_out,
+	uint16_t mtu_size, uint32_t in_hlen)
+{
+	uint16_t frag_size;
+
+	/* room for the fragment header and at least some data. */
+	if (unlikely(mtu_size <= sizeof(struct ipv6_hdr) +
+			sizeof(struct ipv6_extension_fragment)))
+		return -EINVAL;
 
 	frag_size = (uint16_t)(mtu_size - sizeof(struct ipv6_hdr));
 
 	/* Fragment size should be a multiple of 8. */
 	IP_FRAG_ASSERT((frag_size & IPV6_HDR_FO_MASK) == 0);
 
-	/* Check that pkts_out is big enough to hold all fragments */
-	if (unlikely (frag_size * nb_pkts_out <
-	    (uint16_t)(pkt_in->pkt_len - sizeof (struct ipv6_hdr))))
+	/*
+	 * Check that pkts_out is big enough to hold all fragments,
+	 * each of them carries a fragment header of its own.
+	 */
+	if (unlikely ((frag_size - sizeof(struct ipv6_extension_fragment)) *
+	    nb_pkts_out < (uint16_t)(pkt_in->pkt_len - in_hlen)))
 		return -EINVAL;
 
-	in_hdr = rte_pktmbuf_mtod(pkt_in, struct ipv6_hdr *);
+	return 0;
+}
+
+/*
+ * fragment the payload of pkt_in, starting after in_hlen bytes of headers,
+ * fofs and mf are offset and MF flag of the input itself.
+ */
+static inline int32_t
+__ipv6_fragment_packet(struct rte_mbuf *pkt_in,
+	struct rte_mbuf **pkts_out,
+	uint16_t nb_pkts_out,
+	uint16_t mtu_size,
+	struct rte_mempool *pool_direct,
+	struct rte_mempool *pool_indirect,
+	const struct ipv6_hdr *in_hdr, uint32_t in_hlen, uint8_t proto,
+	uint32_t id, uint16_t fofs, uint32_t mf)
+{
+	struct rte_mbuf *in_seg = NULL;
+	uint32_t out_pkt_pos, in_seg_data_pos;
+	uint32_t more_in_segs;
+	uint16_t fragment_offset;
 
 	in_seg = pkt_in;
-	in_seg_data_pos = sizeof(struct ipv6_hdr);
+	in_seg_data_pos = in_hlen;
 	out_pkt_pos = 0;
-	fragment_offset = 0;
+	fragment_offset = fofs;
+
+	/* skip segments holding nothing but the headers */
+	while (in_seg_data_pos == in_seg->data_len && in_seg->next != NULL) {
+		in_seg = in_seg->next;
+		in_seg_data_pos = 0;
+	}
 
 	more_in_segs = 1;
 	while (likely(more_in_segs)) {
@@ -166,7 +208,7 @@ rte_ipv6_fragment_packet(struct rte_mbuf *pkt_in,
 			out_seg_prev = out_seg;
 
 			/* Prepare indirect buffer */
-			rte_pktmbuf_attach(out_seg, in_seg);
+			rte_pktmbuf_attach(out_seg, ip_frag_direct(in_seg));
 			len = mtu_size - out_pkt->pkt_len;
 			if (len > (in_seg->data_len - in_seg_data_pos)) {
 				len = in_seg->data_len - in_seg_data_pos;
@@ -200,7 +242,7 @@ rte_ipv6_fragment_packet(struct rte_mbuf *pkt_in,
 
 		__fill_ipv6hdr_frag(out_hdr, in_hdr,
 		    (uint16_t) out_pkt->pkt_len - sizeof(struct ipv6_hdr),
-		    fragment_offset, more_in_segs);
+		    fragment_offset, more_in_segs | mf, proto, id);
 
 		fragment_offset = (uint16_t)(fragment_offset +
 		    out_pkt->pkt_len - sizeof(struct ipv6_hdr)
@@ -213,3 +255,143 @@ rte_ipv6_fragment_packet(struct rte_mbuf *pkt_in,
 
 	return out_pkt_pos;
 }
+
+int32_t
+rte_ipv6_fragment_packet_idgen(struct rte_mbuf *pkt_in,
+	struct rte_mbuf **pkts_out,
+	uint16_t nb_pkts_out,
+	uint16_t mtu_size,
+	struct rte_mempool *pool_direct,
+	struct rte_mempool *pool_indirect,
+	struct rte_ip_frag_id_gen *id_gen)
+{
+	struct ipv6_hdr *in_hdr;
+	uint32_t id;
+	int32_t ret;
+
+	in_hdr = rte_pktmbuf_mtod(pkt_in, struct ipv6_hdr *);
+
+	/* a fragment keeps the identification of its datagram */
+	if (unlikely(rte_ipv6_frag_get_ipv6_fragment_header(in_hdr) != NULL))
+		return -EINVAL;
+
+	/* take an identification only for a packet that will be split */
+	ret = __ipv6_fragment_check(pkt_in, nb_pkts_out, mtu_size,
+		sizeof(struct ipv6_hdr));
+	if (unlikely(ret != 0))
+		return ret;
+
+	/* All fragments of the datagram share the same identification */
+	id = rte_cpu_to_be_32(rte_ipv6_frag_id_next(id_gen, in_hdr));
+
+	return __ipv6_fragment_packet(pkt_in, pkts_out, nb_pkts_out, mtu_size,
+		pool_direct, pool_indirect, in_hdr, sizeof(struct ipv6_hdr),
+		in_hdr->proto, id, 0, 0);
+}
+
+/**
+ * IPv6 refragmentation.
+ *
+ * Splits an IPv6 fragment to fit the egress MTU, without reassembly:
+ * every output fragment keeps the identification of the input,
+ * its offset is relative to the input's offset and the last one keeps
+ * the input's M flag. A packet without fragment header is fragmented
+ * as by rte_ipv6_fragment_packet().
+ * A packet that already fits is passed through untouched.
+ *
+ * @param pkt_in
+ *   The input fragment, consumed on success.
+ * @param pkts_out
+ *   Array storing the output fragments.
+ * @param nb_pkts_out
+ *   Number of entries in pkts_out.
+ * @param mtu_size
+ *   Size in bytes of the egress MTU, including the IPv6 header,
+ *   the fragment payload is rounded down to a multiple of 8.
+ * @param pool_direct
+ *   MBUF pool used for allocating direct buffers for the output fragments.
+ * @param pool_indirect
+ *   MBUF pool used for allocating indirect buffers for the output fragments.
+ * @return
+ *   Upon successful completion - number of output fragments placed
+ *   in the pkts_out array.
+ *   Otherwise - (-1) * <errno>.
+ */
+int32_t
+rte_ipv6_refragment_packet(struct rte_mbuf *pkt_in,
+	struct rte_mbuf **pkts_out,
+	uint16_t nb_pkts_out,
+	uint16_t mtu_size,
+	struct rte_mempool *pool_direct,
+	struct rte_mempool *pool_indirect)
+{
+	struct ipv6_hdr *in_hdr;
+	struct ipv6_extension_fragment *frag_hdr;
+	uint16_t fofs;
+	int32_t ret;
+
+	if (unlikely(nb_pkts_out == 0))
+		return -EINVAL;
+
+	/* fits already, nothing to do */
+	if (pkt_in->pkt_len <= mtu_size) {
+		pkts_out[0] = pkt_in;
+		return 1;
+	}
+
+	if (unlikely(mtu_size < sizeof(struct ipv6_hdr) +
+			sizeof(*frag_hdr) + (1 << IPV6_HDR_FO_SHIFT)))
+		return -EINVAL;
+
+	mtu_size = (uint16_t)(mtu_size -
+		((mtu_size - sizeof(struct ipv6_hdr)) & IPV6_HDR_FO_MASK));
+
+	in_hdr = rte_pktmbuf_mtod(pkt_in, struct ipv6_hdr *);
+	frag_hdr = rte_ipv6_frag_get_ipv6_fragment_header(in_hdr);
+
+	if (frag_hdr == NULL)
+		ret = rte_ipv6_fragment_packet(pkt_in, pkts_out, nb_pkts_out,
+			mtu_size, pool_direct, pool_indirect);
+	else {
+		/* offset and M flag of the input carry over. */
+		fofs = rte_be_to_cpu_16(frag_hdr->frag_data);
+		ret = __ipv6_fragment_check(pkt_in, nb_pkts_out, mtu_size,
+			sizeof(*in_hdr) + sizeof(*frag_hdr));
+		if (unlikely(ret != 0))
+			return ret;
+
+		ret = __ipv6_fragment_packet(pkt_in, pkts_out, nb_pkts_out,
+			mtu_size, pool_direct, pool_indirect, in_hdr,
+			sizeof(*in_hdr) + sizeof(*frag_hdr),
+			frag_hdr->next_header, frag_hdr->id,
+			(uint16_t)(fofs & ~IPV6_HDR_FO_MASK),
+			(fofs & IPV6_HDR_MF_MASK) >> IPV6_HDR_MF_SHIFT);
+	}
+
+	/* fragments hold their own references to the data. */
+	if (ret > 0)
+		rte_pktmbuf_free(pkt_in);
+	return ret;
+}
+
+uint16_t
+rte_ipv6_frag_size_mtu(const struct rte_mbuf *pkt_in, uint16_t mtu_size,
+	enum rte_ip_frag_size_mode mode, uint16_t buf_size)
+{
+	const struct ipv6_hdr *in_hdr;
+	uint32_t in_hlen;
+
+	/* fits, nothing to size. */
+	if (pkt_in->pkt_len <= mtu_size)
+		return mtu_size;
+
+	/* an existing fragment header is replaced, not added to. */
+	in_hdr = rte_pktmbuf_mtod(pkt_in, const struct ipv6_hdr *);
+	in_hlen = sizeof(*in_hdr);
+	if (in_hdr->proto == IPPROTO_FRAGMENT)
+		in_hlen += sizeof(struct ipv6_extension_fragment);
+
+	return ip_frag_size_mtu(mode, buf_size, mtu_size,
+		sizeof(*in_hdr) + sizeof(struct ipv6_extension_fragment),
+		pkt_in->pkt_len - in_hlen);
+}
@@ -63,10 +63,10 @@ ipv6_frag_reassemble(struct ip_frag_pkt *fp)
 {
 	struct ipv6_hdr *ip_hdr;
 	struct ipv6_extension_fragment *frag_hdr;
-	struct rte_mbuf *m, *prev;
-	uint32_t i, n, ofs, first_len;
+	struct rte_mbuf *m;
+	uint32_t i, n, ofs, prev, first_len;
 	uint32_t last_len, move_len, payload_len;
-	uint32_t curr_idx = 0;
+	struct ip_frag *frag, *curr;
 
 	first_len = fp->frags[IP_FIRST_FRAG_IDX].len;
 	n = fp->last_idx - 1;
@@ -75,40 +75,50 @@ ipv6_frag_reassemble(struct ip_frag_pkt *fp)
 	m = fp->frags[IP_LAST_FRAG_IDX].mb;
 	ofs = fp->frags[IP_LAST_FRAG_IDX].ofs;
 	last_len = fp->frags[IP_LAST_FRAG_IDX].len;
-	curr_idx = IP_LAST_FRAG_IDX;
+	curr = fp->frags + IP_LAST_FRAG_IDX;
 
 	payload_len = ofs + last_len;
 
 	while (ofs != first_len) {
 
-		prev = m;
+		prev = ofs;
 
 		for (i = n; i != IP_FIRST_FRAG_IDX && ofs != first_len; i--) {
 
+			frag = ip_frag_slot(fp, i);
+
 			/* previous fragment found. */
-			if (fp->frags[i].ofs + fp->frags[i].len == ofs) {
+			if (frag->ofs + frag->len == ofs) {
 
-				ip_frag_chain(fp->frags[i].mb, m);
+				/* fragments copied on arrival need no chaining. */
+				if (fp->buf == NULL) {
+					ip_frag_chain(frag->mb, frag->tail, m);
 
-				/* this mbuf should not be accessed directly */
-				fp->frags[curr_idx].mb = NULL;
-				curr_idx = i;
+					/* this mbuf should not be accessed directly */
+					curr->mb = NULL;
+					curr = frag;
+					m = frag->mb;
+				}
 
 				/* update our last fragment and offset. */
-				m = fp->frags[i].mb;
-				ofs = fp->frags[i].ofs;
+				ofs = frag->ofs;
 			}
 		}
 
 		/* error - hole in the packet. */
-		if (m == prev) {
+		if (ofs == prev) {
 			return NULL;
 		}
 	}
 
-	/* chain with the first fragment. */
-	ip_frag_chain(fp->frags[IP_FIRST_FRAG_IDX].mb, m);
-	m = fp->frags[IP_FIRST_FRAG_IDX].mb;
+	/* chain with the first fragment, or take the copy buffer. */
+	if (fp->buf != NULL)
+		m = ip_frag_copy_take(fp);
+	else {
+		ip_frag_chain(fp->frags[IP_FIRST_FRAG_IDX].mb,
+			fp->frags[IP_FIRST_FRAG_IDX].tail, m);
+		m = fp->frags[IP_FIRST_FRAG_IDX].mb;
+	}
 
 	/* update mbuf fields for reassembled packet. */
 	m->ol_flags |= PKT_TX_IP_CKSUM;
@@ -123,7 +133,8 @@ ipv6_frag_reassemble(struct ip_frag_pkt *fp)
 	 * the last non-fragmentable header with the "next header" field to contain
 	 * type of the first fragmentable header, but we currently don't support
 	 * other headers, so we assume there are no other headers and thus update
-	 * the main IPv6 header instead.
+	 * the main IPv6 header instead. Headers of the first fragment are
+	 * expected to be within its first segment.
 	 */
 	move_len = m->l2_len + m->l3_len - sizeof(*frag_hdr);
 	frag_hdr = (struct ipv6_extension_fragment *) (ip_hdr + 1);
@@ -137,40 +148,41 @@ ipv6_frag_reassemble(struct ip_frag_pkt *fp)
 	return m;
 }
 
-/*
- * Process new mbuf with fragment of IPV6 datagram.
- * Incoming mbuf should have its l2_len/l3_len fields setup correctly.
- * @param tbl
- *   Table where to lookup/add the fragmented packet.
- * @param mb
- *   Incoming mbuf with IPV6 fragment.
- * @param tms
- *   Fragment arrival timestamp.
- * @param ip_hdr
- *   Pointer to the IPV6 header.
- * @param frag_hdr
- *   Pointer to the IPV6 fragment extension header.
- * @return
- *   Pointer to mbuf for reassembled packet, or NULL if:
- *   - an error occured.
- *   - not all fragments of the packet are collected yet.
- */
 #define MORE_FRAGS(x) (((x) & 0x100) >> 8)
 #define FRAG_OFFSET(x) (rte_cpu_to_be_16(x) >> 3)
-struct rte_mbuf *
-rte_ipv6_frag_reassemble_packet(struct rte_ip_frag_tbl *tbl,
-		struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb, uint64_t tms,
-		struct ipv6_hdr *ip_hdr, struct ipv6_extension_fragment *frag_hdr)
+
+/* fill the datagram key of IPV6 fragment */
+static inline void
+ipv6_frag_key(const struct ipv6_hdr *ip_hdr,
+	const struct ipv6_extension_fragment *frag_hdr, struct ip_frag_key *key)
 {
-	struct ip_frag_pkt *fp;
-	struct ip_frag_key key;
-	uint16_t ip_len, ip_ofs;
+	rte_memcpy(&key->src_dst[0], ip_hdr->src_addr, 16);
+	rte_memcpy(&key->src_dst[2], ip_hdr->dst_addr, 16);
 
-	rte_memcpy(&key.src_dst[0], ip_hdr->src_addr, 16);
-	rte_memcpy(&key.src_dst[2], ip_hdr->dst_addr, 16);
+	key->id = frag_hdr->id;
+	key->key_len = IPV6_KEYLEN;
+}
 
-	key.id = frag_hdr->id;
-	key.key_len = IPV6_KEYLEN;
+/* fill offset, length and flags of IPV6 fragment */
+static inline void
+ipv6_frag_desc(const struct ipv6_hdr *ip_hdr,
+	const struct ipv6_extension_fragment *frag_hdr, struct ip_frag_desc *fd)
+{
+	fd->ofs = FRAG_OFFSET(frag_hdr->frag_data) * 8;
+	fd->len = rte_be_to_cpu_16(ip_hdr->payload_len) - sizeof(*frag_hdr);
+	fd->more_frags = MORE_FRAGS(frag_hdr->frag_data);
+	fd->done = 0;
+}
+
+/* add IPV6 fragment to its datagram, sig is the key hash or NULL */
+static inline struct rte_mbuf *
+ipv6_frag_reassemble_key(struct rte_ip_frag_tbl *tbl,
+	struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb, uint64_t tms,
+	struct ipv6_hdr *ip_hdr, struct ipv6_extension_fragment *frag_hdr,
+	const struct ip_frag_key *key, const uint32_t *sig)
+{
+	struct ip_frag_pkt *fp;
+	uint16_t ip_len, ip_ofs;
 
 	ip_ofs = FRAG_OFFSET(frag_hdr->frag_data) * 8;
 
@@ -187,12 +199,15 @@ rte_ipv6_frag_reassemble_packet(struct rte_ip_frag_tbl *tbl,
 		"tbl: %p, max_cycles: %" PRIu64 ", entry_mask: %#x, "
 		"max_entries: %u, use_entries: %u\n\n",
 		__func__, __LINE__,
-		mb, tms, IPv6_KEY_BYTES(key.src_dst), key.id, ip_ofs, ip_len, frag_hdr->more_frags,
+		mb, tms, IPv6_KEY_BYTES(key->src_dst), key->id, ip_ofs, ip_len, frag_hdr->more_frags,
 		tbl, tbl->max_cycles, tbl->entry_mask, tbl->max_entries,
 		tbl->use_entries);
 
+	ip_frag_socket_check(tbl, mb);
+
 	/* try to find/add entry into the fragment's table. */
-	fp = ip_frag_find(tbl, dr, &key, tms);
+	fp = ip_frag_find(tbl, dr, key, sig, ip_ofs, ip_len,
+		IP_FRAG_FIND_REASSEMBLE, tms);
 	if (fp == NULL) {
 		IP_FRAG_MBUF2DR(dr, mb);
 		return NULL;
@@ -204,12 +219,12 @@ rte_ipv6_frag_reassemble_packet(struct rte_ip_frag_tbl *tbl,
 		", total_size: %u, frag_size: %u, last_idx: %u\n\n",
 		__func__, __LINE__,
 		tbl, tbl->max_entries, tbl->use_entries,
-		fp, IPv6_KEY_BYTES(fp->key.src_dst), fp->key.id, fp->start,
+		fp, IPv6_KEY_BYTES(fp->key.src_dst), fp->key.id, (uint64_t)fp->start,
 		fp->total_size, fp->frag_size, fp->last_idx);
 
 
 	/* process the fragmented packet. */
-	mb = ip_frag_process(fp, dr, mb, ip_ofs, ip_len,
+	mb = ip_frag_process(tbl, fp, dr, mb, ip_ofs, ip_len,
 			MORE_FRAGS(frag_hdr->frag_data));
 	ip_frag_inuse(tbl, fp);
 
@@ -220,8 +235,199 @@ rte_ipv6_frag_reassemble_packet(struct rte_ip_frag_tbl *tbl,
 		", total_size: %u, frag_size: %u, last_idx: %u\n\n",
 		__func__, __LINE__, mb,
 		tbl, tbl->max_entries, tbl->use_entries,
-		fp, IPv6_KEY_BYTES(fp->key.src_dst), fp->key.id, fp->start,
+		fp, IPv6_KEY_BYTES(fp->key.src_dst), fp->key.id, (uint64_t)fp->start,
 		fp->total_size, fp->frag_size, fp->last_idx);
 
 	return mb;
 }
+
+/*
+ * Process new mbuf with fragment of IPV6 datagram.
+ * Incoming mbuf should have its l2_len/l3_len fields setup correctly.
+ * @param tbl
+ *   Table where to lookup/add the fragmented packet.
+ * @param mb
+ *   Incoming mbuf with IPV6 fragment.
+ * @param tms
+ *   Fragment arrival timestamp.
+ * @param ip_hdr
+ *   Pointer to the IPV6 header.
+ * @param frag_hdr
+ *   Pointer to the IPV6 fragment extension header.
+ * @return
+ *   Pointer to mbuf for reassembled packet, or NULL if:
+ *   - an error occured.
+ *   - not all fragments of the packet are collected yet.
+ */
+struct rte_mbuf *
+rte_ipv6_frag_reassemble_packet(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb, uint64_t tms,
+		struct ipv6_hdr *ip_hdr, struct ipv6_extension_fragment *frag_hdr)
+{
+	struct ip_frag_key key;
+
+	ipv6_frag_key(ip_hdr, frag_hdr, &key);
+	return ipv6_frag_reassemble_key(tbl, dr, mb, tms, ip_hdr, frag_hdr,
+		&key, NULL);
+}
+
+/*
+ * Process a burst of mbufs with IPV6 fragments.
+ * Keys of up to IP_FRAG_HASH_BURST fragments are hashed together.
+ * Datagrams with all fragments among them are reassembled right away,
+ * other fragments are added to the table one by one.
+ * Fragment header is expected to be the last one within l3_len.
+ */
+uint32_t
+rte_ipv6_frag_reassemble_bulk(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr, struct rte_mbuf **mb,
+		uint32_t num, uint64_t tms)
+{
+	struct ipv6_hdr *ip_hdr[IP_FRAG_HASH_BURST];
+	struct ipv6_extension_fragment *frag_hdr[IP_FRAG_HASH_BURST];
+	struct ip_frag_key key[IP_FRAG_HASH_BURST];
+	struct ip_frag_desc fd[IP_FRAG_HASH_BURST];
+	uint32_t sig1[IP_FRAG_HASH_BURST], sig2[IP_FRAG_HASH_BURST];
+	uint32_t i, k, n, nb_out, sig[IP_FRAG_HASH_FNUM];
+	struct rte_mbuf *m;
+
+	nb_out = 0;
+	for (i = 0; i != num; i += n) {
+		n = RTE_MIN(num - i, (uint32_t)IP_FRAG_HASH_BURST);
+
+		for (k = 0; k != n; k++) {
+			m = mb[i + k];
+			ip_hdr[k] = rte_pktmbuf_mtod_offset(m,
+				struct ipv6_hdr *, m->l2_len);
+			frag_hdr[k] = rte_pktmbuf_mtod_offset(m,
+				struct ipv6_extension_fragment *,
+				m->l2_len + m->l3_len - sizeof(*frag_hdr[k]));
+			ipv6_frag_key(ip_hdr[k], frag_hdr[k], key + k);
+			ipv6_frag_desc(ip_hdr[k], frag_hdr[k], fd + k);
+		}
+
+		rte_ip_frag_hash_bulk(tbl, key, n, sig1, sig2);
+
+		nb_out += ip_frag_burst_reassemble(tbl, mb + i, key, sig1, sig2,
+			fd, n, tms);
+
+		for (k = 0; k != n; k++) {
+			if (fd[k].done != 0)
+				continue;
+			sig[0] = sig1[k];
+			sig[1] = sig2[k];
+			mb[i + k] = ipv6_frag_reassemble_key(tbl, dr, mb[i + k],
+				tms, ip_hdr[k], frag_hdr[k], key + k, sig);
+			nb_out += (mb[i + k] != NULL);
+		}
+	}
+
+	return nb_out;
+}
+
+/*
+ * Forward IPV6 fragment, once the first fragment of its datagram told
+ * the L4 flow, along with the fragments that waited for it.
+ */
+uint32_t
+rte_ipv6_frag_forward_packet(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr, struct rte_mbuf *mb, uint64_t tms,
+		struct ipv6_hdr *ip_hdr, struct ipv6_extension_fragment *frag_hdr,
+		struct rte_mbuf **out)
+{
+	struct ip_frag_pkt *fp;
+	struct ip_frag_key key;
+	struct ip_frag_desc fd;
+	uint32_t n;
+
+	/* copy mode buffer takes the place of the flow. */
+	if (unlikely(tbl->copy_pool != NULL)) {
+		IP_FRAG_MBUF2DR(dr, mb);
+		return 0;
+	}
+
+	ipv6_frag_key(ip_hdr, frag_hdr, &key);
+	ipv6_frag_desc(ip_hdr, frag_hdr, &fd);
+
+	ip_frag_socket_check(tbl, mb);
+
+	/* try to find/add entry into the fragment's table. */
+	if ((fp = ip_frag_find(tbl, dr, &key, NULL, fd.ofs, fd.len,
+			IP_FRAG_FIND_FORWARD, tms)) == NULL) {
+		IP_FRAG_MBUF2DR(dr, mb);
+		return 0;
+	}
+
+	n = ip_frag_forward(tbl, fp, dr, mb, fd.ofs, fd.len, fd.more_frags,
+		out);
+	ip_frag_inuse(tbl, fp);
+
+	IP_FRAG_LOG(DEBUG, "%s:%d:\n"
+		"mbuf: %p, forwarded: %u\n"
+		"ipv6_frag_pkt: %p, key: <" IPv6_KEY_BYTES_FMT ", %#x>, start: %" PRIu64
+		", total_size: %u, frag_size: %u, last_idx: %u\n\n",
+		__func__, __LINE__, mb, n,
+		fp, IPv6_KEY_BYTES(fp->key.src_dst), fp->key.id, (uint64_t)fp->start,
+		fp->total_size, fp->frag_size, fp->last_idx);
+
+	return n;
+}
+
+/*
+ * Tag a burst of IPV6 fragments with hash of their L4 flow, as learnt
+ * from the first fragment of each datagram. Mbufs stay with the caller.
+ */
+uint32_t
+rte_ipv6_frag_flow_bulk(struct rte_ip_frag_tbl *tbl,
+		struct rte_ip_frag_death_row *dr, struct rte_mbuf **mb,
+		uint32_t num, uint64_t tms)
+{
+	struct ipv6_hdr *ip_hdr;
+	struct ipv6_extension_fragment *frag_hdr[IP_FRAG_HASH_BURST];
+	struct ip_frag_key key[IP_FRAG_HASH_BURST];
+	struct ip_frag_desc fd[IP_FRAG_HASH_BURST];
+	uint32_t sig1[IP_FRAG_HASH_BURST], sig2[IP_FRAG_HASH_BURST];
+	uint32_t i, k, n, nb_out, sig[IP_FRAG_HASH_FNUM];
+	struct ip_frag_pkt *fp;
+	struct rte_mbuf *m;
+
+	/* copy mode buffer takes the place of the flow. */
+	if (unlikely(tbl->copy_pool != NULL))
+		return 0;
+
+	nb_out = 0;
+	for (i = 0; i != num; i += n) {
+		n = RTE_MIN(num - i, (uint32_t)IP_FRAG_HASH_BURST);
+
+		for (k = 0; k != n; k++) {
+			m = mb[i + k];
+			ip_hdr = rte_pktmbuf_mtod_offset(m,
+				struct ipv6_hdr *, m->l2_len);
+			frag_hdr[k] = rte_pktmbuf_mtod_offset(m,
+				struct ipv6_extension_fragment *,
+				m->l2_len + m->l3_len - sizeof(*frag_hdr[k]));
+			ipv6_frag_key(ip_hdr, frag_hdr[k], key + k);
+			ipv6_frag_desc(ip_hdr, frag_hdr[k], fd + k);
+		}
+
+		rte_ip_frag_hash_bulk(tbl, key, n, sig1, sig2);
+
+		for (k = 0; k != n; k++) {
+			sig[0] = sig1[k];
+			sig[1] = sig2[k];
+			fp = ip_frag_find(tbl, dr, key + k, sig, fd[k].ofs,
+				fd[k].len, IP_FRAG_FIND_FLOW, tms);
+			if (fp == NULL) {
+				mb[i + k]->ol_flags &= ~PKT_RX_RSS_HASH;
+				continue;
+			}
+
+			nb_out += ip_frag_flow(tbl, fp, mb[i + k], fd[k].ofs,
+				fd[k].len, fd[k].more_frags,
+				frag_hdr[k]->next_header);
+			ip_frag_inuse(tbl, fp);
+		}
+	}
+
+	return nb_out;
+}
@@ -80,6 +80,7 @@
 
 #define FRAG
 #define IPV4_MTU_DEFAULT		ETHER_MTU
+#define TEST_DST_ADDR			0x01020304
 
 #define MAX_PKT_BURST 32
 
@@ -103,11 +104,20 @@
 #define	MIN_FLOW_TTL	1
 #define	DEF_FLOW_TTL	MS_PER_S			/* timeout in 1 sec */
 
+/* places a fragment is moved ahead in the burst check stream */
+#define	DEF_BURST_WINDOW	8
+
 #define MAX_FRAG_NUM RTE_LIBRTE_IP_FRAG_MAX_FRAG
 
 /* Should be power of two. */
 #define	IP_FRAG_TBL_BUCKET_ENTRIES	16
 
+/* buckets to migrate per fragment, while the table is resized */
+#define	IP_FRAG_TBL_RESIZE_STEP	4
+
+/* per-source quota counters per sketch row, should be power of two. */
+#define	IP_FRAG_TBL_QUOTA_COUNTERS	1024
+
 /* Configure how many packets ahead to prefetch, when reading packets */
 #define PREFETCH_OFFSET	3
 
@@ -119,11 +129,35 @@ static struct app_config_t {
 	uint32_t dump:1,
 			 stat:1,
 			 gc:1,	/* garbage collection */
-			 reserved:29;
+			 burst:1,	/* reassemble fragments as a burst */
+			 copy:1,	/* copy fragments into one buffer per datagram */
+			 forward:1,	/* forward fragments without reassembly */
+			 classify:1,	/* tag fragments with their flow hash */
+			 reserved:25;
 	uint32_t error;	/* error case, 1: missing last fragment */
 	uint32_t mtu;
 	uint32_t frags;
 	uint32_t log_level;
+	int32_t id_mode;	/* fragment id generator, -1: keep id */
+	uint32_t grow_load;	/* resize table at that % load, 0: fixed size */
+	uint32_t shrink_load;
+	uint32_t quota_pkts;	/* datagrams per source, 0: no limit */
+	uint32_t quota_bytes;	/* bytes per source, 0: no limit */
+	uint32_t budget_mbufs;	/* mbufs buffered per table, 0: no limit */
+	uint32_t budget_policy;
+	uint32_t evict_policy;	/* eviction on full table */
+	int32_t hash_type;	/* table key hash, -1: library default */
+	uint32_t hash_bench;	/* keys per hash benchmark run, 0: off */
+	uint32_t lookup_bench;	/* datagrams per lookup benchmark, 0: off */
+	uint32_t cache_bench;	/* datagrams per cache benchmark run, 0: off */
+	uint32_t burst_check;	/* datagrams in bulk/single compare, 0: off */
+	uint32_t burst_window;	/* places a fragment moves ahead in it */
+	uint32_t absorb_len;	/* absorb fragments up to that len, 0: off */
+	uint32_t tomb_bits;	/* tombstone filter bits, 0: off */
+	uint32_t refrag_mtu;	/* refragment fragments to that MTU, 0: off */
+	uint32_t size_mode;	/* fragment sizing */
+	uint32_t size_buf;	/* downstream buffer size */
+	uint32_t pmtu;	/* path MTU cached for the test destination, 0: off */
 	uint64_t count;
 	uint64_t enq_fail;
 } app_config = {
@@ -136,11 +170,28 @@ static struct app_config_t {
 	.log_level = RTE_LOG_INFO,
 	.mtu = IPV4_MTU_DEFAULT,
 	.error = 0,
+	.id_mode = -1,
+	.evict_policy = RTE_IP_FRAG_EVICT_EXPIRED,
+	.hash_type = -1,
 	.dump = 0,
 	.stat = 0,
 	.gc = 0,
 };
 
+static const char * const evict_policy_name[] = {
+	[RTE_IP_FRAG_EVICT_OLDEST] = "oldest",
+	[RTE_IP_FRAG_EVICT_LARGEST] = "largest",
+	[RTE_IP_FRAG_EVICT_LEAST_COMPLETE] = "incomplete",
+	[RTE_IP_FRAG_EVICT_CLOCK] = "clock",
+	[RTE_IP_FRAG_EVICT_EXPIRED] = "expired",
+};
+
+static const char * const hash_type_name[] = {
+	[RTE_IP_FRAG_HASH_CRC] = "crc",
+	[RTE_IP_FRAG_HASH_JHASH] = "jhash",
+	[RTE_IP_FRAG_HASH_MULSHIFT] = "mulshift",
+};
+
 struct mbuf_table {
 	uint32_t len;
 	uint32_t head;
@@ -148,19 +199,33 @@ struct mbuf_table {
 	struct rte_mbuf *m_table[0];
 };
 
-/* reassembly */
-struct rte_mempool *pool;
 struct rte_ring *ring;
 #define RING_NAME		"RING"
 
-/* fragmentation */
-struct rte_mempool *direct_pool;
-struct rte_mempool *indirect_pool;
 #define DIR_MP_NAME		"DIR_MP"
 #define INDIR_MP_NAME	"INDIR_MP"
+#define COPY_MP_NAME	"COPY_MP"
+#define	ID_GEN_COUNTERS	1024
+#define	PMTU_ENTRIES	1024
+
+/* per-socket mbuf pools, so that lcores never free mbufs across sockets */
+struct socket_conf {
+	struct rte_mempool *pool;			/* reassembly */
+	struct rte_mempool *direct_pool;	/* fragmentation */
+	struct rte_mempool *indirect_pool;
+	struct rte_mempool *copy_pool;		/* datagram buffers, copy mode */
+	struct rte_ip_frag_id_gen *id_gen;
+	struct rte_ip_frag_pmtu *pmtu;		/* path MTU cache */
+	uint32_t nb_mbuf;					/* mbufs requested by lcores */
+	uint32_t nb_copy;					/* datagram buffers requested */
+	uint32_t nb_lcore;
+	size_t tbl_bytes;					/* fragment tables memory */
+};
+static struct socket_conf socket_conf[RTE_MAX_NUMA_NODES];
 
 struct lcore_queue_conf {
 	struct rte_ip_frag_tbl *frag_tbl;
+	struct socket_conf *sconf;
 	struct rte_ip_frag_death_row death_row;
 } __rte_cache_aligned;
 static struct lcore_queue_conf lcore_queue_conf[RTE_MAX_LCORE];
@@ -243,7 +308,7 @@ reassemble(struct rte_mbuf *m, uint8_t portid, uint32_t queue,
 	}
 }
 
-static inline struct rte_mbuf *build_pkt(void)
+static inline struct rte_mbuf *build_pkt(struct rte_mempool *pool)
 {
 	static uint64_t tx_count = 0;
 	static uint16_t packet_id = 0;
@@ -262,7 +327,7 @@ static inline struct rte_mbuf *build_pkt(void)
 		return NULL;
 
 	ip = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
-	ip->dst_addr = 0x01020304;
+	ip->dst_addr = TEST_DST_ADDR;
 	ip->src_addr = 0x02030405;
 
 #ifdef FRAG
@@ -303,6 +368,9 @@ producer(void)
 	uint64_t prev_tsc;
 	uint64_t interval_tsc;
 	struct rte_mbuf *m = NULL;
+	struct socket_conf *sconf;
+
+	sconf = lcore_queue_conf[rte_lcore_id()].sconf;
    
 	interval_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * (1000000/app_config.tx_pps);
 	prev_tsc = 0;
@@ -317,7 +385,7 @@ producer(void)
 		{
 			prev_tsc = cur_tsc;
 
-			m = build_pkt();
+			m = build_pkt(sconf->pool);
 
 			if (unlikely(m != NULL)) {
 				if (rte_ring_enqueue(ring, m) < 0) {
@@ -341,31 +409,43 @@ static void rte_print_lru(struct rte_ip_frag_tbl *tbl)
 	struct ip_frag_pkt *fp;
 	uint64_t max_cycles;
 	uint64_t cur_tsc;
+	uint64_t elapsed;
 	uint32_t expired = 0;
-	struct ip_pkt_list *lru;
 	uint32_t i;
 	uint32_t count = 0;
 
 	max_cycles = tbl->max_cycles;
-	cur_tsc = rte_rdtsc();
-
-	lru = &tbl->lru;
+	cur_tsc = rte_ip_frag_clock();
 
 	RTE_LOG(INFO, IP_RSMBL, "----------------------------------------\n");
 	RTE_LOG(INFO, IP_RSMBL, "Print LRU list\n");
-	TAILQ_FOREACH(fp, lru, lru) {
+#ifdef RTE_LIBRTE_IP_FRAG_EPOCH_AGING
+	/* no LRU list with epoch aging, walk through the table instead */
+	for (fp = tbl->pkt; fp != tbl->pkt + tbl->nb_entries; fp++) {
+		if (fp->key.key_len == 0)
+			continue;
+
+		/* elapsed time is in epochs */
+		elapsed = (uint32_t)((uint32_t)(cur_tsc >> tbl->epoch_shift) -
+			fp->start);
+		expired = (elapsed > tbl->max_epochs);
+		RTE_SET_USED(max_cycles);
+#else
+	TAILQ_FOREACH(fp, &tbl->lru, lru) {
 		if ((max_cycles + fp->start) < cur_tsc) {
 			expired = 1;
 		} else {
 			expired = 0;
 		}
+		elapsed = cur_tsc - fp->start;
+#endif
 
 		/* Note. Assume that the first fragment is received */
 		RTE_LOG(INFO, IP_RSMBL, "[%4u] lru %p mbuf[1] %p id(N) %5u last_idx %u Elapsed:%16ju(%s)\n", 
 				count, fp, fp->frags[1].mb, fp->key.id, fp->last_idx, 
-				cur_tsc - fp->start, expired == 1 ? "expired" : "");
-		for (i = 0 ; i < IP_MAX_FRAG_NUM; i++) {
-			RTE_LOG(INFO, IP_RSMBL, "\t[%u] %p\n", i, fp->frags[i].mb);
+				elapsed, expired == 1 ? "expired" : "");
+		for (i = 0 ; i < fp->last_idx; i++) {
+			RTE_LOG(INFO, IP_RSMBL, "\t[%u] %p\n", i, ip_frag_slot(fp, i)->mb);
 		}
 
 		if (app_config.dump)
@@ -377,16 +457,16 @@ static void rte_print_lru(struct rte_ip_frag_tbl *tbl)
 }
 
 
-inline static void print_mempool_status(void)
+inline static void print_mempool_status(const struct socket_conf *sconf)
 {
 	RTE_LOG(NOTICE, IP_RSMBL, ">>>>> mbuf count %u %u %u\n", 
-			rte_mempool_count(pool),
-			rte_mempool_count(direct_pool),
-			rte_mempool_count(indirect_pool));
+			rte_mempool_count(sconf->pool),
+			rte_mempool_count(sconf->direct_pool),
+			rte_mempool_count(sconf->indirect_pool));
 	RTE_LOG(NOTICE, IP_RSMBL, ">>>>> free mbuf count %u %u %u\n", 
-			rte_mempool_free_count(pool),
-			rte_mempool_free_count(direct_pool),
-			rte_mempool_free_count(indirect_pool));
+			rte_mempool_free_count(sconf->pool),
+			rte_mempool_free_count(sconf->direct_pool),
+			rte_mempool_free_count(sconf->indirect_pool));
 }
 
 #define REPORT_INTERVAL_US	1000000
@@ -400,6 +480,7 @@ consumer(void)
 	uint64_t prev_tsc;
 
 	struct lcore_queue_conf *qconf;
+	struct socket_conf *sconf;
 	const uint64_t interval_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S
 		* (1000000/app_config.tx_pps);
 	const uint64_t display_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S
@@ -416,6 +497,7 @@ consumer(void)
 	lcore_id = rte_lcore_id();
 
 	qconf = &lcore_queue_conf[lcore_id];
+	sconf = qconf->sconf;
 
 	RTE_LOG(INFO, IP_RSMBL, "entering main loop on lcore %u\n", lcore_id);
 	RTE_LOG(INFO, IP_RSMBL, "process %ju packets\n", app_config.count);
@@ -438,7 +520,11 @@ consumer(void)
 
 		if (diff_tsc > interval_tsc) {
 			prev_tsc = cur_tsc;
-			m = build_pkt();
+
+			/* one clock update per burst, fragments read the cached value */
+			rte_ip_frag_clock_update();
+
+			m = build_pkt(sconf->pool);
 			if (unlikely(m == NULL)) {
 				rte_panic("mbuf alloc fail\n");
 			}
@@ -453,47 +539,168 @@ consumer(void)
 #ifdef FRAG
 			{
 #define NB_FRAGS		4
-				struct rte_mbuf *m_table[NB_FRAGS];
+#define NB_REFRAGS		8
+				struct rte_mbuf *m_table[NB_FRAGS * NB_REFRAGS];
+				uint16_t mtu;
 				int ret;
 				int i;
 
-				ret = rte_ipv4_fragment_packet(m, (struct rte_mbuf **)&m_table, 
-						NB_FRAGS, app_config.mtu, direct_pool, indirect_pool);
+				mtu = app_config.mtu;
+				if (sconf->pmtu != NULL)
+					rte_ipv4_frag_pmtu_lookup_bulk(sconf->pmtu, &m, 1,
+						mtu, &mtu, rte_ip_frag_clock());
+
+				mtu = rte_ipv4_frag_size_mtu(m, mtu,
+					app_config.size_mode, app_config.size_buf);
+
+				if (sconf->id_gen != NULL)
+					ret = rte_ipv4_fragment_packet_idgen(m,
+							(struct rte_mbuf **)&m_table, NB_FRAGS,
+							mtu, sconf->direct_pool,
+							sconf->indirect_pool, sconf->id_gen);
+				else
+					ret = rte_ipv4_fragment_packet(m, (struct rte_mbuf **)&m_table, 
+							NB_FRAGS, mtu, sconf->direct_pool,
+							sconf->indirect_pool);
 				rte_pktmbuf_free(m);
 				RTE_LOG(INFO, IP_RSMBL, "%d fragments\n", ret);
 
 				if (ret < 0) {
 					RTE_LOG(ERR, IP_RSMBL, "fail to fragment (%d)\n", ret);
-					print_mempool_status();
+					print_mempool_status(sconf);
 					continue;
 				}
 
-				/* not good to modify ret */
-				for (i = 0; i < ret-1; i++) {
-					RTE_LOG(INFO, IP_RSMBL, "[%p] fragments : for reassembly\n", 
-							m_table[i]);
-					m = reassemble(m_table[i], 0, 0, qconf, cur_tsc);
+				if (app_config.refrag_mtu != 0) {
+					struct rte_mbuf *r_table[NB_FRAGS * NB_REFRAGS];
+					int n, k;
+
+					/* a smaller link on the way splits them again. */
+					for (i = 0, k = 0; i < ret; i++, k += n) {
+						mtu = rte_ipv4_frag_size_mtu(m_table[i],
+							app_config.refrag_mtu,
+							app_config.size_mode,
+							app_config.size_buf);
+						n = rte_ipv4_refragment_packet(m_table[i],
+							&r_table[k], RTE_DIM(r_table) - k, mtu,
+							sconf->direct_pool,
+							sconf->indirect_pool);
+						if (n < 0)
+							break;
+					}
+
+					if (i != ret) {
+						RTE_LOG(ERR, IP_RSMBL, "fail to refragment "
+							"(%d)\n", n);
+						for (; i < ret; i++)
+							rte_pktmbuf_free(m_table[i]);
+						for (i = 0; i < k; i++)
+							rte_pktmbuf_free(r_table[i]);
+						continue;
+					}
+
+					RTE_LOG(INFO, IP_RSMBL, "%d fragments refragmented "
+						"into %d\n", ret, k);
+					memcpy(m_table, r_table, k * sizeof(m_table[0]));
+					ret = k;
 				}
 
-				if (m != NULL) {
-					RTE_LOG(ERR, IP_RSMBL, "[%p] Errorenous reassembly\n", m);
-					rte_panic("Error in reassembly\n");
-				}
-
-				if (app_config.error == 1) {
-					RTE_LOG(INFO, IP_RSMBL, "[%p] fragments : freed\n", 
-							m_table[ret-1]);
-					rte_pktmbuf_free(m_table[ret-1]);
+				if (app_config.forward) {
+					struct rte_mbuf *fwd[IP_MAX_FRAG_NUM];
+					uint32_t j, n, nb_fwd;
+
+					if (app_config.error == 1)
+						rte_pktmbuf_free(m_table[--ret]);
+
+					/* first fragment comes last, others wait for it. */
+					nb_fwd = 0;
+					for (i = ret; i-- != 0; ) {
+						m_table[i]->l2_len = 0;
+						m_table[i]->l3_len = sizeof(*ip);
+						n = rte_ipv4_frag_forward_packet(
+							qconf->frag_tbl, &qconf->death_row,
+							m_table[i], rte_ip_frag_clock(),
+							rte_pktmbuf_mtod(m_table[i],
+							struct ipv4_hdr *), fwd);
+						for (j = 0; j != n; j++)
+							rte_pktmbuf_free(fwd[j]);
+						nb_fwd += n;
+					}
+
+					RTE_LOG(INFO, IP_RSMBL, "%u of %d fragments "
+						"forwarded\n", nb_fwd, ret);
+					m = NULL;
+					if (nb_fwd == (uint32_t)ret)
+						reasm_count++;
+				} else if (app_config.classify) {
+					uint32_t nb_tag;
+
+					if (app_config.error == 1)
+						rte_pktmbuf_free(m_table[--ret]);
+
+					for (i = 0; i < ret; i++) {
+						m_table[i]->l2_len = 0;
+						m_table[i]->l3_len = sizeof(*ip);
+					}
+
+					/* fragments stay with us, only tagged. */
+					nb_tag = rte_ipv4_frag_flow_bulk(qconf->frag_tbl,
+						&qconf->death_row, m_table, ret,
+						rte_ip_frag_clock());
+					for (i = 0; i < ret; i++)
+						rte_pktmbuf_free(m_table[i]);
+
+					RTE_LOG(INFO, IP_RSMBL, "%u of %d fragments "
+						"tagged\n", nb_tag, ret);
+					m = NULL;
+					if (nb_tag == (uint32_t)ret)
+						reasm_count++;
+				} else if (app_config.burst) {
+					if (app_config.error == 1)
+						rte_pktmbuf_free(m_table[--ret]);
+
+					for (i = 0; i < ret; i++) {
+						m_table[i]->l2_len = 0;
+						m_table[i]->l3_len = sizeof(*ip);
+					}
+
+					/* keys of all fragments are hashed at once. */
+					rte_ipv4_frag_reassemble_bulk(qconf->frag_tbl,
+						&qconf->death_row, m_table, ret,
+						rte_ip_frag_clock());
+
+					m = NULL;
+					for (i = 0; i < ret; i++)
+						if (m_table[i] != NULL)
+							m = m_table[i];
 				} else {
-					RTE_LOG(INFO, IP_RSMBL, "[%p] fragments : for reassembly\n", 
-							m_table[ret-1]);
-					m = reassemble(m_table[ret-1], 0, 0, qconf, cur_tsc);
+					/* not good to modify ret */
+					for (i = 0; i < ret-1; i++) {
+						RTE_LOG(INFO, IP_RSMBL, "[%p] fragments : for reassembly\n", 
+								m_table[i]);
+						m = reassemble(m_table[i], 0, 0, qconf, rte_ip_frag_clock());
+					}
+
+					if (m != NULL) {
+						RTE_LOG(ERR, IP_RSMBL, "[%p] Errorenous reassembly\n", m);
+						rte_panic("Error in reassembly\n");
+					}
+
+					if (app_config.error == 1) {
+						RTE_LOG(INFO, IP_RSMBL, "[%p] fragments : freed\n", 
+								m_table[ret-1]);
+						rte_pktmbuf_free(m_table[ret-1]);
+					} else {
+						RTE_LOG(INFO, IP_RSMBL, "[%p] fragments : for reassembly\n", 
+								m_table[ret-1]);
+						m = reassemble(m_table[ret-1], 0, 0, qconf, rte_ip_frag_clock());
+					}
 				}
 
 				count++;
 			}
 #else
-			m = reassemble(m, 0, i, qconf, cur_tsc);
+			m = reassemble(m, 0, i, qconf, rte_ip_frag_clock());
 			count++;
 #endif
 
@@ -526,7 +733,7 @@ consumer(void)
 					incr_rx * 1500*8/1000/1000,
 					app_config.enq_fail);
 
-			print_mempool_status();
+			print_mempool_status(sconf);
 
 			if (app_config.stat)
 				rte_ip_frag_table_statistics_dump(stdout, qconf->frag_tbl);
@@ -536,15 +743,20 @@ consumer(void)
 		}
 
 		if (app_config.gc)
-			rte_ip_frag_check_lru(qconf->frag_tbl, &qconf->death_row, cur_tsc);
+			rte_ip_frag_check_lru(qconf->frag_tbl, &qconf->death_row,
+				rte_ip_frag_clock());
+
+		/* memory for a resize is allocated here, not per fragment. */
+		if (app_config.grow_load != 0)
+			rte_ip_frag_table_resize_prepare(qconf->frag_tbl);
 
 		rte_ip_frag_free_death_row(&qconf->death_row, PREFETCH_OFFSET);
 	}
 
 	/* garbage colect repeately */
-	while (rte_mempool_free_count(pool) || 
-			rte_mempool_free_count(direct_pool) || 
-			rte_mempool_free_count(indirect_pool)) {
+	while (rte_mempool_free_count(sconf->pool) || 
+			rte_mempool_free_count(sconf->direct_pool) || 
+			rte_mempool_free_count(sconf->indirect_pool)) {
 
 		rte_delay_ms(10);	
 		cur_tsc = rte_rdtsc();
@@ -553,11 +765,14 @@ consumer(void)
 		rte_ip_frag_free_death_row(&qconf->death_row, PREFETCH_OFFSET);
 
 		rte_ip_frag_table_statistics_dump(stdout, qconf->frag_tbl);
-		print_mempool_status();
+		print_mempool_status(sconf);
 	}
 
 	if (app_config.stat)
 		rte_ip_frag_table_statistics_dump(stdout, qconf->frag_tbl);
+
+	RTE_LOG(NOTICE, IP_RSMBL, "evict %s: rx %ju reasm %ju\n",
+		evict_policy_name[app_config.evict_policy], count, reasm_count);
 }
 
 
@@ -596,7 +811,28 @@ print_usage(const char *prgname)
 		"  --error=<code>:0 No error, 1 miss last fragment"
 		"  --dump:1:Dump"
 		"  --stat:1:Print Stats"
-		"  --gc:1:Garbage colection",
+		"  --gc:1:Garbage colection"
+		"  --burst:reassemble fragments of a packet as a burst"
+		"  --copy:copy fragments into one buffer per datagram"
+		"  --forward:forward fragments as their flow is known"
+		"  --classify:tag fragments with hash of their flow"
+		"  --absorb=<bytes>:copy smaller fragments into their neighbors"
+		"  --tombstone=<bits>:drop late fragments of finished datagrams"
+		"  --refrag=<mtu>:split fragments again for a smaller MTU"
+		"  --fragsize=<mode>:fragment sizes, fill, equal or buf:<bytes>"
+		"  --pmtu=<mtu>:cached path MTU of the test destination"
+		"  --idgen=<mode>:fragment id, lcore, dst or random"
+		"  --resize=<grow>:<shrink>:resize table at %% of maxflows"
+		"  --quota=<pkts>:<bytes>:in-flight limits per source"
+		"  --budget=<mbufs>[:<policy>]:mbufs per table"
+		"  --evict=<policy>:on full table, expired, oldest, largest, "
+		"incomplete or clock"
+		"  --hash=<hash>:table key hash, crc, jhash or mulshift"
+		"  --hashbench=<keys>:measure key hashes and exit"
+		"  --lookupbench=<datagrams>:measure table lookups and exit"
+		"  --cachebench=<datagrams>:measure lookup cache hits and exit"
+		"  --burstcheck=<datagrams>[:<window>]:compare bulk and "
+		"per-packet reassembly of shuffled fragments and exit",
 		prgname);
 }
 
@@ -648,6 +884,21 @@ parse_flow_ttl(const char *str, uint32_t min, uint32_t max, uint32_t *val)
 	return (0);
 }
 
+static int
+parse_evict_policy(const char *str, uint32_t *val)
+{
+	uint32_t i;
+
+	for (i = 0; i != RTE_DIM(evict_policy_name); i++) {
+		if (strcmp(str, evict_policy_name[i]) == 0) {
+			*val = i;
+			return (0);
+		}
+	}
+
+	return (-EINVAL);
+}
+
 /* Parse the argument given in the command line of the application */
 static int
 parse_args(int argc, char **argv)
@@ -655,6 +906,7 @@ parse_args(int argc, char **argv)
 	int opt, ret;
 	char **argvopt;
 	int option_index;
+	uint32_t i;
 	char *prgname = argv[0];
 	static struct option lgopts[] = {
 		{"max-pkt-len", 1, 0, 0},
@@ -669,6 +921,25 @@ parse_args(int argc, char **argv)
 		{"dump", 0, 0, 0},
 		{"stat", 0, 0, 0},
 		{"gc", 0, 0, 0},
+		{"burst", 0, 0, 0},
+		{"copy", 0, 0, 0},
+		{"forward", 0, 0, 0},
+		{"classify", 0, 0, 0},
+		{"absorb", 1, 0, 0},
+		{"tombstone", 1, 0, 0},
+		{"refrag", 1, 0, 0},
+		{"fragsize", 1, 0, 0},
+		{"pmtu", 1, 0, 0},
+		{"idgen", 1, 0, 0},
+		{"resize", 1, 0, 0},
+		{"quota", 1, 0, 0},
+		{"budget", 1, 0, 0},
+		{"evict", 1, 0, 0},
+		{"hash", 1, 0, 0},
+		{"hashbench", 1, 0, 0},
+		{"lookupbench", 1, 0, 0},
+		{"cachebench", 1, 0, 0},
+		{"burstcheck", 1, 0, 0},
 		{NULL, 0, 0, 0}
 	};
 
@@ -776,6 +1047,193 @@ parse_args(int argc, char **argv)
 				app_config.gc = 1;
 			}
 
+			if (!strncmp(lgopts[option_index].name, "burst", 5)) {
+				app_config.burst = 1;
+			}
+
+			if (!strncmp(lgopts[option_index].name, "copy", 4)) {
+				app_config.copy = 1;
+			}
+
+			if (!strcmp(lgopts[option_index].name, "forward")) {
+				app_config.forward = 1;
+			}
+
+			if (!strcmp(lgopts[option_index].name, "classify")) {
+				app_config.classify = 1;
+			}
+
+			if (!strcmp(lgopts[option_index].name, "absorb")) {
+				if (parse_flow_num(optarg, 0, UINT16_MAX,
+						&app_config.absorb_len) != 0) {
+					printf("invalid absorb\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "tombstone")) {
+				if (parse_flow_num(optarg, 64, INT32_MAX,
+						&app_config.tomb_bits) != 0 ||
+						!rte_is_power_of_2(app_config.tomb_bits)) {
+					printf("invalid tombstone\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "refrag")) {
+				if (parse_flow_num(optarg, sizeof(struct ipv4_hdr) + 8,
+						IPV4_MTU_DEFAULT,
+						&app_config.refrag_mtu) != 0) {
+					printf("invalid refrag\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "pmtu")) {
+				if (parse_flow_num(optarg, 68, IPV4_MTU_DEFAULT,
+						&app_config.pmtu) != 0) {
+					printf("invalid pmtu\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "fragsize")) {
+				if (!strcmp(optarg, "fill"))
+					app_config.size_mode = RTE_IP_FRAG_SIZE_FILL;
+				else if (!strcmp(optarg, "equal"))
+					app_config.size_mode = RTE_IP_FRAG_SIZE_EQUAL;
+				else if (sscanf(optarg, "buf:%u",
+						&app_config.size_buf) == 1 &&
+						app_config.size_buf != 0 &&
+						app_config.size_buf <= UINT16_MAX)
+					app_config.size_mode = RTE_IP_FRAG_SIZE_BUF;
+				else {
+					printf("invalid fragsize\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strncmp(lgopts[option_index].name, "idgen", 5)) {
+				if (!strcmp(optarg, "lcore"))
+					app_config.id_mode = RTE_IP_FRAG_ID_PER_LCORE;
+				else if (!strcmp(optarg, "dst"))
+					app_config.id_mode = RTE_IP_FRAG_ID_PER_DST;
+				else if (!strcmp(optarg, "random"))
+					app_config.id_mode = RTE_IP_FRAG_ID_RANDOM;
+				else {
+					printf("invalid idgen\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strncmp(lgopts[option_index].name, "resize", 6)) {
+				if (sscanf(optarg, "%u:%u", &app_config.grow_load,
+						&app_config.shrink_load) != 2 ||
+						app_config.grow_load == 0 ||
+						app_config.grow_load > 100 ||
+						app_config.shrink_load * 2 >= app_config.grow_load) {
+					printf("invalid resize thresholds\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strncmp(lgopts[option_index].name, "quota", 5)) {
+				if (sscanf(optarg, "%u:%u", &app_config.quota_pkts,
+						&app_config.quota_bytes) != 2 ||
+						(app_config.quota_pkts == 0 &&
+						app_config.quota_bytes == 0)) {
+					printf("invalid quota\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strncmp(lgopts[option_index].name, "budget", 6)) {
+				char policy[16] = "oldest";
+
+				if (sscanf(optarg, "%u:%15s", &app_config.budget_mbufs,
+						policy) < 1 ||
+						app_config.budget_mbufs == 0) {
+					printf("invalid budget\n");
+					print_usage(prgname);
+					return -1;
+				}
+
+				if (parse_evict_policy(policy,
+						&app_config.budget_policy) != 0) {
+					printf("invalid eviction policy\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strncmp(lgopts[option_index].name, "evict", 5)) {
+				if (parse_evict_policy(optarg,
+						&app_config.evict_policy) != 0) {
+					printf("invalid eviction policy\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "hash")) {
+				for (i = 0; i != RTE_DIM(hash_type_name); i++)
+					if (!strcmp(optarg, hash_type_name[i]))
+						app_config.hash_type = i;
+				if (app_config.hash_type < 0) {
+					printf("invalid hash\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "hashbench")) {
+				if (parse_flow_num(optarg, 1, UINT32_MAX / 2,
+						&app_config.hash_bench) != 0) {
+					printf("invalid hashbench\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "lookupbench")) {
+				if (parse_flow_num(optarg, 1, MAX_FLOW_NUM,
+						&app_config.lookup_bench) != 0) {
+					printf("invalid lookupbench\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "cachebench")) {
+				if (parse_flow_num(optarg, 1, MAX_FLOW_NUM,
+						&app_config.cache_bench) != 0) {
+					printf("invalid cachebench\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
+			if (!strcmp(lgopts[option_index].name, "burstcheck")) {
+				app_config.burst_window = DEF_BURST_WINDOW;
+				if (sscanf(optarg, "%u:%u", &app_config.burst_check,
+						&app_config.burst_window) < 1 ||
+						app_config.burst_check == 0 ||
+						app_config.burst_check > MAX_FLOW_NUM ||
+						app_config.burst_window == 0) {
+					printf("invalid burstcheck\n");
+					print_usage(prgname);
+					return -1;
+				}
+			}
+
 			break;
 
 		default:
@@ -784,6 +1242,13 @@ parse_args(int argc, char **argv)
 		}
 	}
 
+	/* forwarded or classified datagrams are never copied. */
+	if (app_config.copy + app_config.forward + app_config.classify > 1) {
+		printf("--copy, --forward and --classify are exclusive\n");
+		print_usage(prgname);
+		return -1;
+	}
+
 	if (optind >= 0)
 		argv[optind-1] = prgname;
 
@@ -800,8 +1265,8 @@ setup_queue_tbl(uint32_t lcore, uint32_t queue)
 	int socket;
 	uint32_t nb_mbuf;
 	uint64_t frag_cycles;
-	char buf[RTE_MEMPOOL_NAMESIZE];
 	struct lcore_queue_conf *qconf;
+	struct socket_conf *sconf;
 
 	qconf = &lcore_queue_conf[lcore];
 
@@ -809,6 +1274,9 @@ setup_queue_tbl(uint32_t lcore, uint32_t queue)
 	if (socket == SOCKET_ID_ANY)
 		socket = 0;
 
+	sconf = &socket_conf[socket];
+	qconf->sconf = sconf;
+
 	frag_cycles = (rte_get_tsc_hz() + MS_PER_S - 1) / MS_PER_S *
 		app_config.max_flow_ttl;
 
@@ -821,52 +1289,749 @@ setup_queue_tbl(uint32_t lcore, uint32_t queue)
 		return -1;
 	}
 
+	/* only IPv4 fragments are generated. */
+	if (rte_ip_frag_table_set_family(qconf->frag_tbl,
+			RTE_IP_FRAG_FAMILY_IPV4) != 0) {
+		RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_family on "
+			"lcore: %u for queue: %u failed\n", lcore, queue);
+		return -1;
+	}
+
+	if (app_config.hash_type >= 0) {
+		struct rte_ip_frag_hash_params prm = {
+			.type = app_config.hash_type,
+		};
+
+		if (rte_ip_frag_table_set_hash(qconf->frag_tbl, &prm) != 0) {
+			RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_hash on "
+				"lcore: %u for queue: %u failed\n", lcore, queue);
+			return -1;
+		}
+	}
+
+	if (rte_ip_frag_table_set_absorb(qconf->frag_tbl,
+			app_config.absorb_len) != 0) {
+		RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_absorb on "
+			"lcore: %u for queue: %u failed\n", lcore, queue);
+		return -1;
+	}
+
+	if (app_config.tomb_bits != 0) {
+		struct rte_ip_frag_tombstone_params prm = {
+			.nb_bits = app_config.tomb_bits,
+		};
+
+		if (rte_ip_frag_table_set_tombstone(qconf->frag_tbl,
+				&prm) != 0) {
+			RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_tombstone on "
+				"lcore: %u for queue: %u failed\n", lcore, queue);
+			return -1;
+		}
+	}
+
+	if (app_config.grow_load != 0) {
+		struct rte_ip_frag_resize_params prm = {
+			.min_bucket_num = MIN_FLOW_NUM,
+			.max_bucket_num = MAX_FLOW_NUM,
+			.grow_load = app_config.grow_load,
+			.shrink_load = app_config.shrink_load,
+			.step = IP_FRAG_TBL_RESIZE_STEP,
+		};
+
+		if (rte_ip_frag_table_set_resize(qconf->frag_tbl, &prm) != 0) {
+			RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_resize on "
+				"lcore: %u for queue: %u failed\n", lcore, queue);
+			return -1;
+		}
+	}
+
+	if (app_config.quota_pkts != 0 || app_config.quota_bytes != 0) {
+		struct rte_ip_frag_quota_params prm = {
+			.nb_counters = IP_FRAG_TBL_QUOTA_COUNTERS,
+			.max_pkts = app_config.quota_pkts,
+			.max_bytes = app_config.quota_bytes,
+		};
+
+		if (rte_ip_frag_table_set_quota(qconf->frag_tbl, &prm) != 0) {
+			RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_quota on "
+				"lcore: %u for queue: %u failed\n", lcore, queue);
+			return -1;
+		}
+	}
+
+	if (rte_ip_frag_table_set_evict(qconf->frag_tbl,
+			app_config.evict_policy) != 0) {
+		RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_evict on "
+			"lcore: %u for queue: %u failed\n", lcore, queue);
+		return -1;
+	}
+
+	if (app_config.budget_mbufs != 0) {
+		struct rte_ip_frag_budget_params prm = {
+			.max_mbufs = app_config.budget_mbufs,
+			.policy = app_config.budget_policy,
+		};
+
+		if (rte_ip_frag_table_set_budget(qconf->frag_tbl, &prm) != 0) {
+			RTE_LOG(ERR, IP_RSMBL, "ip_frag_tbl_set_budget on "
+				"lcore: %u for queue: %u failed\n", lcore, queue);
+			return -1;
+		}
+	}
+
 	/*
 	 * At any given moment up to <max_flow_num * (MAX_FRAG_NUM)>
 	 * mbufs could be stored int the fragment table.
 	 * Plus, each TX queue can hold up to <max_flow_num> packets.
+	 * With a budget, the table never holds more than budget_mbufs.
+	 * In copy mode, fragments are freed on arrival, and the table holds
+	 * one buffer per datagram from the copy pool instead.
+	 * The table is IPv4 only, no room is kept for IPv6 datagrams.
 	 */
 
-	nb_mbuf = RTE_MAX(app_config.max_flow_num, 2UL * MAX_PKT_BURST) * MAX_FRAG_NUM;
-	nb_mbuf *= (port_conf.rxmode.max_rx_pkt_len + BUF_SIZE - 1) / BUF_SIZE;
-	nb_mbuf *= 2; /* ipv4 and ipv6 */
+	if (app_config.copy) {
+		sconf->nb_copy += app_config.max_flow_num + 2 * MAX_PKT_BURST;
+		nb_mbuf = 2UL * MAX_PKT_BURST * MAX_FRAG_NUM;
+	} else if (app_config.budget_mbufs != 0) {
+		nb_mbuf = app_config.budget_mbufs;
+		nb_mbuf += 2UL * MAX_PKT_BURST * MAX_FRAG_NUM;
+	} else {
+		nb_mbuf = RTE_MAX(app_config.max_flow_num, 2UL * MAX_PKT_BURST) * MAX_FRAG_NUM;
+		nb_mbuf *= (port_conf.rxmode.max_rx_pkt_len + BUF_SIZE - 1) / BUF_SIZE;
+	}
 	nb_mbuf += 1024;//RTE_TEST_RX_DESC_DEFAULT + RTE_TEST_TX_DESC_DEFAULT;
 
 	nb_mbuf = RTE_MAX(nb_mbuf, (uint32_t)NB_MBUF);
 
-	snprintf(buf, sizeof(buf), "mbuf_pool_%u_%u", lcore, queue);
+	/* pools are created per socket, once all lcores are accounted. */
+	sconf->nb_mbuf += nb_mbuf;
+	sconf->nb_lcore++;
+	sconf->tbl_bytes += qconf->frag_tbl->mem_size;
 
-	if ((pool = rte_mempool_create(buf, nb_mbuf, MBUF_SIZE, 0,
-			sizeof(struct rte_pktmbuf_pool_private),
-			rte_pktmbuf_pool_init, NULL, rte_pktmbuf_init, NULL,
-			socket, MEMPOOL_F_SP_PUT | MEMPOOL_F_SC_GET)) == NULL) {
-		RTE_LOG(ERR, IP_RSMBL, "mempool_create(%s) failed(%u, %ju)", buf, nb_mbuf, MBUF_SIZE);
+	return 0;
+}
+
+/* fill IPv4 or IPv6 keys, either of one src/dst pair or random ones */
+static void
+hash_bench_keys(struct ip_frag_key *keys, uint32_t num, uint32_t key_len,
+	int rnd)
+{
+	uint32_t i, j;
+
+	memset(keys, 0, num * sizeof(keys[0]));
+	for (i = 0; i != num; i++) {
+		for (j = 0; j != key_len; j++)
+			keys[i].src_dst[j] = rnd ? rte_rand() : j + 0x0a000001;
+		keys[i].id = rnd ? (uint32_t)rte_rand() : i;
+		keys[i].key_len = key_len;
+	}
+}
+
+/*
+ * Measure cycles per key of rte_ip_frag_hash_bulk() for each hash,
+ * and how evenly the keys spread over table buckets: the most loaded
+ * bucket against the mean, and keys with both hash values in one bucket.
+ */
+static int
+hash_bench(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t key_len;
+		int rnd;
+	} pattern[] = {
+		{"ipv4 one src/dst", IPV4_KEYLEN, 0},
+		{"ipv4 random", IPV4_KEYLEN, 1},
+		{"ipv6 random", IPV6_KEYLEN, 1},
+	};
+	struct rte_ip_frag_hash_params prm;
+	struct rte_ip_frag_tbl *tbl;
+	struct ip_frag_key *keys;
+	uint32_t *sig1, *sig2, *load;
+	uint32_t i, k, n, b1, b2, nb_line, max_load, same;
+	uint64_t start, cycles;
+	int ret;
+
+	n = app_config.hash_bench;
+	keys = NULL;
+	sig1 = NULL;
+	sig2 = NULL;
+	load = NULL;
+
+	tbl = rte_ip_frag_table_create(app_config.max_flow_num,
+		IP_FRAG_TBL_BUCKET_ENTRIES, app_config.max_flow_num,
+		rte_get_tsc_hz(), SOCKET_ID_ANY);
+	if (tbl != NULL) {
+		/* buckets the table really has, as indexed below */
+		nb_line = tbl->entry_mask / tbl->bucket_entries + 1;
+		keys = rte_malloc(NULL, n * sizeof(keys[0]),
+			RTE_CACHE_LINE_SIZE);
+		sig1 = rte_malloc(NULL, n * sizeof(sig1[0]),
+			RTE_CACHE_LINE_SIZE);
+		sig2 = rte_malloc(NULL, n * sizeof(sig2[0]),
+			RTE_CACHE_LINE_SIZE);
+		load = rte_malloc(NULL, nb_line * sizeof(load[0]),
+			RTE_CACHE_LINE_SIZE);
+	}
+	if (tbl == NULL || keys == NULL || sig1 == NULL || sig2 == NULL ||
+			load == NULL) {
+		RTE_LOG(ERR, IP_RSMBL, "hash benchmark setup failed\n");
+		ret = -1;
+		goto out;
+	}
+
+	for (prm.type = 0; prm.type != RTE_DIM(hash_type_name); prm.type++) {
+		prm.seed = 0;
+		if (rte_ip_frag_table_set_hash(tbl, &prm) != 0)
+			continue;
+
+		for (k = 0; k != RTE_DIM(pattern); k++) {
+			hash_bench_keys(keys, n, pattern[k].key_len, pattern[k].rnd);
+
+			start = rte_rdtsc();
+			for (i = 0; i < n; i += MAX_PKT_BURST)
+				rte_ip_frag_hash_bulk(tbl, keys + i,
+					RTE_MIN(n - i, (uint32_t)MAX_PKT_BURST),
+					sig1 + i, sig2 + i);
+			cycles = rte_rdtsc() - start;
+
+			memset(load, 0, nb_line * sizeof(load[0]));
+			max_load = 0;
+			same = 0;
+			for (i = 0; i != n; i++) {
+				b1 = (sig1[i] & tbl->entry_mask) / tbl->bucket_entries;
+				b2 = (sig2[i] & tbl->entry_mask) / tbl->bucket_entries;
+				max_load = RTE_MAX(max_load, ++load[b1]);
+				same += (b1 == b2);
+			}
+
+			RTE_LOG(NOTICE, IP_RSMBL, "hash %s, %s keys: "
+				"%.2f cycles/key, max bucket %u (mean %.2f), "
+				"same buckets %u of %u\n",
+				hash_type_name[prm.type], pattern[k].name,
+				(double)cycles / n, max_load, (double)n / nb_line,
+				same, n);
+		}
+	}
+	ret = 0;
+
+out:
+	rte_free(load);
+	rte_free(sig2);
+	rte_free(sig1);
+	rte_free(keys);
+	if (tbl != NULL)
+		rte_ip_frag_table_destroy(tbl);
+	return ret;
+}
+
+/* fragments per lookup benchmark datagram, and payload bytes of each */
+#define	LOOKUP_BENCH_FRAGS	4
+#define	LOOKUP_BENCH_FRAG_LEN	512
+
+/* build fragment <idx> of <LOOKUP_BENCH_FRAGS> of datagram <id> */
+static struct rte_mbuf *
+lookup_bench_frag(struct rte_mempool *pool, uint32_t id, uint32_t idx)
+{
+	struct rte_mbuf *m;
+	struct ipv4_hdr *ip;
+	uint16_t ofs;
+
+	m = rte_pktmbuf_alloc(pool);
+	if (m == NULL)
+		return NULL;
+
+	ofs = idx * LOOKUP_BENCH_FRAG_LEN / IPV4_HDR_OFFSET_UNITS;
+	if (idx != LOOKUP_BENCH_FRAGS - 1)
+		ofs |= IPV4_HDR_MF_FLAG;
+
+	ip = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
+	ip->dst_addr = 0x01020304;
+	ip->src_addr = rte_cpu_to_be_32(0x0a000000 + (id >> 16));
+	ip->packet_id = rte_cpu_to_be_16(id & 0xFFFF);
+	ip->fragment_offset = rte_cpu_to_be_16(ofs);
+	ip->total_length = rte_cpu_to_be_16(sizeof(*ip) + LOOKUP_BENCH_FRAG_LEN);
+
+	m->pkt_len = m->data_len = sizeof(*ip) + LOOKUP_BENCH_FRAG_LEN;
+	m->l2_len = 0;
+	m->l3_len = sizeof(*ip);
+
+	return m;
+}
+
+/*
+ * Measure cycles per fragment of rte_ipv4_frag_reassemble_packet(),
+ * on the master lcore table: first fragments that add table entries,
+ * middle ones that find them, and last ones that complete datagrams.
+ * Builds with and without RTE_LIBRTE_IP_FRAG_DEBUG give the cost of
+ * lookup tracing.
+ */
+static int
+lookup_bench(void)
+{
+	struct lcore_queue_conf *qconf;
+	struct rte_mbuf **frags, *m;
+	uint64_t start, tms, middle, cycles[LOOKUP_BENCH_FRAGS];
+	uint32_t i, k, n, done;
+
+	qconf = &lcore_queue_conf[rte_lcore_id()];
+	n = RTE_MIN(app_config.lookup_bench, app_config.max_flow_num);
+
+	frags = rte_malloc(NULL, n * LOOKUP_BENCH_FRAGS * sizeof(frags[0]), 0);
+	if (frags == NULL) {
+		RTE_LOG(ERR, IP_RSMBL, "lookup benchmark setup failed\n");
 		return -1;
 	}
 
+	for (i = 0; i != n * LOOKUP_BENCH_FRAGS; i++) {
+		frags[i] = lookup_bench_frag(qconf->sconf->pool, i / LOOKUP_BENCH_FRAGS,
+			i % LOOKUP_BENCH_FRAGS);
+		if (frags[i] == NULL) {
+			RTE_LOG(ERR, IP_RSMBL, "mbuf alloc fail\n");
+			while (i-- != 0)
+				rte_pktmbuf_free(frags[i]);
+			rte_free(frags);
+			return -1;
+		}
+	}
+
+	/* fragments of one index are looked up together, for all datagrams */
+	tms = rte_rdtsc();
+	done = 0;
+	for (k = 0; k != LOOKUP_BENCH_FRAGS; k++) {
+		start = rte_rdtsc();
+		for (i = 0; i != n; i++) {
+			m = frags[i * LOOKUP_BENCH_FRAGS + k];
+			frags[i * LOOKUP_BENCH_FRAGS + k] = rte_ipv4_frag_reassemble_packet(
+				qconf->frag_tbl, &qconf->death_row, m, tms,
+				rte_pktmbuf_mtod(m, struct ipv4_hdr *));
+			if (qconf->death_row.cnt >= IP_FRAG_DEATH_ROW_LEN)
+				rte_ip_frag_free_death_row(&qconf->death_row,
+					PREFETCH_OFFSET);
+		}
+		cycles[k] = rte_rdtsc() - start;
+	}
+
+	/* absorbed fragments are NULL, only reassembled datagrams are left */
+	for (i = 0; i != n * LOOKUP_BENCH_FRAGS; i++) {
+		if (frags[i] == NULL)
+			continue;
+		if (i % LOOKUP_BENCH_FRAGS == LOOKUP_BENCH_FRAGS - 1)
+			done++;
+		rte_pktmbuf_free(frags[i]);
+	}
+	rte_ip_frag_free_death_row(&qconf->death_row, PREFETCH_OFFSET);
+	rte_free(frags);
+
+	middle = 0;
+	for (k = 1; k != LOOKUP_BENCH_FRAGS - 1; k++)
+		middle += cycles[k];
+
+	if (n != 0)
+		RTE_LOG(NOTICE, IP_RSMBL, "lookup (trace %s): "
+			"first %.2f, middle %.2f, last %.2f cycles/fragment, "
+			"%u of %u datagrams reassembled\n",
+#ifdef RTE_LIBRTE_IP_FRAG_DEBUG
+			"on",
+#else
+			"off",
+#endif
+			(double)cycles[0] / n,
+			(double)middle / ((LOOKUP_BENCH_FRAGS - 2) * n),
+			(double)cycles[LOOKUP_BENCH_FRAGS - 1] / n, done, n);
 	return 0;
 }
 
+/* most datagrams in flight at once in the cache benchmark */
+#define	CACHE_BENCH_MAX_FLIGHT	64
+
+/*
+ * Measure lookup cache hits of rte_ipv4_frag_reassemble_packet() on the
+ * master lcore table, with 1, 2, 4 ... datagrams in flight: their
+ * fragments arrive interleaved, fragment k of each datagram, then
+ * fragment k + 1 of each one. Hit ratio is over the fragments after the
+ * first one of each datagram, hits are only counted in builds with
+ * RTE_LIBRTE_IP_FRAG_TBL_STAT.
+ */
 static int
-setup_frag(void)
+cache_bench(void)
 {
-	int socket = 0;
+	struct lcore_queue_conf *qconf;
+	struct rte_ip_frag_tbl *tbl;
+	struct rte_mbuf *frags[CACHE_BENCH_MAX_FLIGHT * LOOKUP_BENCH_FRAGS], *m;
+	uint64_t start, tms, hit, cycles;
+	uint32_t flight, i, k, n, nb, id, done;
 
-	direct_pool = rte_pktmbuf_pool_create(DIR_MP_NAME, NB_MBUF, 32,
-			0, RTE_MBUF_DEFAULT_BUF_SIZE, socket);
-	if (direct_pool == NULL) {
-		RTE_LOG(ERR, IP_FRAG, "Cannot create direct mempool\n");
+	qconf = &lcore_queue_conf[rte_lcore_id()];
+	tbl = qconf->frag_tbl;
+	n = app_config.cache_bench;
+
+#ifndef RTE_LIBRTE_IP_FRAG_TBL_STAT
+	RTE_LOG(WARNING, IP_RSMBL, "cache hits are not counted, "
+		"build with RTE_LIBRTE_IP_FRAG_TBL_STAT\n");
+#endif
+
+	tms = rte_rdtsc();
+	id = 0;
+	for (flight = 1; flight <= CACHE_BENCH_MAX_FLIGHT &&
+			flight <= app_config.max_flow_num; flight *= 2) {
+
+		hit = tbl->stat.cache_hit;
+		cycles = 0;
+		done = 0;
+		for (nb = 0; nb < n; nb += flight, id += flight) {
+			for (i = 0; i != flight * LOOKUP_BENCH_FRAGS; i++) {
+				frags[i] = lookup_bench_frag(qconf->sconf->pool,
+					id + i / LOOKUP_BENCH_FRAGS,
+					i % LOOKUP_BENCH_FRAGS);
+				if (frags[i] == NULL) {
+					RTE_LOG(ERR, IP_RSMBL, "mbuf alloc fail\n");
+					while (i-- != 0)
+						rte_pktmbuf_free(frags[i]);
+					return -1;
+				}
+			}
+
+			start = rte_rdtsc();
+			for (k = 0; k != LOOKUP_BENCH_FRAGS; k++) {
+				for (i = 0; i != flight; i++) {
+					m = frags[i * LOOKUP_BENCH_FRAGS + k];
+					frags[i * LOOKUP_BENCH_FRAGS + k] =
+						rte_ipv4_frag_reassemble_packet(tbl,
+						&qconf->death_row, m, tms,
+						rte_pktmbuf_mtod(m, struct ipv4_hdr *));
+					if (qconf->death_row.cnt >=
+							IP_FRAG_DEATH_ROW_LEN)
+						rte_ip_frag_free_death_row(
+							&qconf->death_row,
+							PREFETCH_OFFSET);
+				}
+			}
+			cycles += rte_rdtsc() - start;
+
+			/* absorbed fragments are NULL, only datagrams are left */
+			for (i = 0; i != flight * LOOKUP_BENCH_FRAGS; i++) {
+				if (frags[i] == NULL)
+					continue;
+				if (i % LOOKUP_BENCH_FRAGS == LOOKUP_BENCH_FRAGS - 1)
+					done++;
+				rte_pktmbuf_free(frags[i]);
+			}
+			rte_ip_frag_free_death_row(&qconf->death_row,
+				PREFETCH_OFFSET);
+		}
+
+		RTE_LOG(NOTICE, IP_RSMBL, "cache (%u in flight): "
+			"%.2f cycles/fragment, %.1f%% hits, "
+			"%u of %u datagrams reassembled\n",
+			flight, (double)cycles / (nb * LOOKUP_BENCH_FRAGS),
+			100.0 * (tbl->stat.cache_hit - hit) /
+			(nb * (LOOKUP_BENCH_FRAGS - 1)), done, nb);
+	}
+
+	return 0;
+}
+
+/* % of fragments duplicated, overlapped and lost in the burst check */
+#define	BURST_CHECK_DUP_PCT	2
+#define	BURST_CHECK_OVERLAP_PCT	1
+#define	BURST_CHECK_LOST_PCT	2
+
+/* fragment of the burst check stream */
+struct burst_check_frag {
+	uint32_t id;
+	uint16_t idx;
+	uint16_t shift;	/* bytes to move it ahead, to overlap the next one */
+};
+
+static struct rte_mbuf *
+burst_check_build(struct rte_mempool *pool, const struct burst_check_frag *bf)
+{
+	struct rte_mbuf *m;
+	struct ipv4_hdr *ip;
+
+	m = lookup_bench_frag(pool, bf->id, bf->idx);
+	if (m != NULL && bf->shift != 0) {
+		ip = rte_pktmbuf_mtod(m, struct ipv4_hdr *);
+		ip->fragment_offset = rte_cpu_to_be_16(
+			rte_be_to_cpu_16(ip->fragment_offset) +
+			bf->shift / IPV4_HDR_OFFSET_UNITS);
+	}
+
+	return m;
+}
+
+/*
+ * Feed the stream to the table in bursts of MAX_PKT_BURST, through
+ * rte_ipv4_frag_reassemble_bulk() or fragment by fragment, and record
+ * length of each datagram reassembled.
+ */
+static int
+burst_check_run(struct rte_ip_frag_tbl *tbl, struct rte_mempool *pool,
+	const struct burst_check_frag *bf, uint32_t nb_frag, uint64_t tms,
+	int bulk, uint32_t *len, uint32_t *nb_done)
+{
+	struct rte_ip_frag_death_row dr;
+	struct rte_mbuf *mb[MAX_PKT_BURST];
+	struct ipv4_hdr *ip;
+	uint32_t i, k, n, id;
+
+	dr.cnt = 0;
+	*nb_done = 0;
+	for (i = 0; i < nb_frag; i += n) {
+		n = RTE_MIN(nb_frag - i, (uint32_t)MAX_PKT_BURST);
+		for (k = 0; k != n; k++) {
+			mb[k] = burst_check_build(pool, bf + i + k);
+			if (mb[k] == NULL) {
+				RTE_LOG(ERR, IP_RSMBL, "mbuf alloc fail\n");
+				while (k-- != 0)
+					rte_pktmbuf_free(mb[k]);
+				return -1;
+			}
+		}
+
+		if (bulk)
+			rte_ipv4_frag_reassemble_bulk(tbl, &dr, mb, n, tms);
+		else {
+			for (k = 0; k != n; k++)
+				mb[k] = rte_ipv4_frag_reassemble_packet(tbl, &dr,
+					mb[k], tms,
+					rte_pktmbuf_mtod(mb[k], struct ipv4_hdr *));
+		}
+
+		for (k = 0; k != n; k++) {
+			if (mb[k] == NULL)
+				continue;
+			ip = rte_pktmbuf_mtod(mb[k], struct ipv4_hdr *);
+			id = (rte_be_to_cpu_32(ip->src_addr) - 0x0a000000) << 16 |
+				rte_be_to_cpu_16(ip->packet_id);
+			len[id] = mb[k]->pkt_len;
+			(*nb_done)++;
+			rte_pktmbuf_free(mb[k]);
+		}
+		rte_ip_frag_free_death_row(&dr, PREFETCH_OFFSET);
+	}
+
+	/* let the datagrams that never completed expire. */
+	tms += 2 * tbl->max_cycles;
+	for (i = 0; tbl->use_entries != 0 && i != tbl->nb_entries; i++) {
+		rte_ip_frag_check_lru(tbl, &dr, tms);
+		rte_ip_frag_free_death_row(&dr, PREFETCH_OFFSET);
+	}
+
+	return 0;
+}
+
+/*
+ * Reassemble a shuffled stream of fragments through the bulk and the
+ * per-packet path, each with a table of its own, and check that both
+ * complete the same datagrams. The stream has duplicated, overlapping
+ * and lost fragments, and fragments moved into later bursts, so that
+ * their datagrams are already in the table when the rest arrive.
+ * Tables should have room for all datagrams in flight: the bulk path
+ * completes datagrams within a burst even when its table is full.
+ */
+static int
+burst_check(void)
+{
+	struct lcore_queue_conf *qconf;
+	struct rte_ip_frag_tbl *tbl[2];
+	struct burst_check_frag *bf, t;
+	uint32_t *len[2], nb_done[2];
+	uint32_t i, j, k, n, nb_frag, nb_dup, nb_overlap, nb_lost, nb_diff;
+	uint64_t tms;
+	int ret;
+
+	qconf = &lcore_queue_conf[rte_lcore_id()];
+	n = app_config.burst_check;
+
+	/* each fragment could come with a duplicate or an overlap. */
+	bf = rte_malloc(NULL, 2 * n * LOOKUP_BENCH_FRAGS * sizeof(bf[0]), 0);
+	len[0] = rte_zmalloc(NULL, n * sizeof(len[0][0]), 0);
+	len[1] = rte_zmalloc(NULL, n * sizeof(len[1][0]), 0);
+	for (i = 0; i != RTE_DIM(tbl); i++)
+		tbl[i] = rte_ip_frag_table_create(app_config.max_flow_num,
+			IP_FRAG_TBL_BUCKET_ENTRIES, app_config.max_flow_num,
+			rte_get_tsc_hz(), SOCKET_ID_ANY);
+	if (bf == NULL || len[0] == NULL || len[1] == NULL ||
+			tbl[0] == NULL || tbl[1] == NULL) {
+		RTE_LOG(ERR, IP_RSMBL, "burst check setup failed\n");
+		ret = -1;
+		goto out;
+	}
+
+	nb_frag = 0;
+	nb_dup = 0;
+	nb_overlap = 0;
+	nb_lost = 0;
+	for (i = 0; i != n; i++) {
+		for (k = 0; k != LOOKUP_BENCH_FRAGS; k++) {
+			if (rte_rand() % 100 < BURST_CHECK_LOST_PCT) {
+				nb_lost++;
+				continue;
+			}
+			bf[nb_frag].id = i;
+			bf[nb_frag].idx = k;
+			bf[nb_frag].shift = 0;
+			nb_frag++;
+
+			if (rte_rand() % 100 < BURST_CHECK_DUP_PCT) {
+				bf[nb_frag] = bf[nb_frag - 1];
+				nb_frag++;
+				nb_dup++;
+			} else if (k != LOOKUP_BENCH_FRAGS - 1 &&
+					rte_rand() % 100 < BURST_CHECK_OVERLAP_PCT) {
+				bf[nb_frag] = bf[nb_frag - 1];
+				bf[nb_frag].shift = LOOKUP_BENCH_FRAG_LEN / 2;
+				nb_frag++;
+				nb_overlap++;
+			}
+		}
+	}
+
+	/* swap each fragment with one of the next burst_window ones. */
+	for (i = 0; i != nb_frag; i++) {
+		j = i + rte_rand() % RTE_MIN(nb_frag - i,
+			app_config.burst_window);
+		t = bf[i];
+		bf[i] = bf[j];
+		bf[j] = t;
+	}
+
+	tms = rte_rdtsc();
+	ret = burst_check_run(tbl[0], qconf->sconf->pool, bf, nb_frag, tms, 1,
+		len[0], &nb_done[0]);
+	if (ret == 0)
+		ret = burst_check_run(tbl[1], qconf->sconf->pool, bf, nb_frag,
+			tms, 0, len[1], &nb_done[1]);
+	if (ret != 0)
+		goto out;
+
+	nb_diff = 0;
+	for (i = 0; i != n; i++)
+		nb_diff += (len[0][i] != len[1][i]);
+
+	RTE_LOG(NOTICE, IP_RSMBL, "burst check (window %u): %u datagrams, "
+		"%u fragments (%u duplicates, %u overlaps, %u lost), "
+		"reassembled bulk %u, single %u, %u within a burst, %u differ\n",
+		app_config.burst_window, n, nb_frag, nb_dup, nb_overlap, nb_lost,
+		nb_done[0], nb_done[1], (uint32_t)tbl[0]->stat.burst_num,
+		nb_diff);
+#ifndef RTE_LIBRTE_IP_FRAG_TBL_STAT
+	RTE_LOG(NOTICE, IP_RSMBL, "datagrams within a burst are only counted "
+		"with RTE_LIBRTE_IP_FRAG_TBL_STAT\n");
+#endif
+
+	if (nb_diff != 0 || nb_done[0] != nb_done[1])
+		ret = -1;
+
+out:
+	for (i = 0; i != RTE_DIM(tbl); i++)
+		if (tbl[i] != NULL)
+			rte_ip_frag_table_destroy(tbl[i]);
+	rte_free(len[1]);
+	rte_free(len[0]);
+	rte_free(bf);
+	return ret;
+}
+
+static int
+setup_socket_pools(uint32_t socket)
+{
+	char buf[RTE_MEMPOOL_NAMESIZE];
+	struct socket_conf *sconf;
+	unsigned flags;
+
+	sconf = &socket_conf[socket];
+
+	/* single producer/consumer is only safe with one lcore per pool */
+	flags = (sconf->nb_lcore == 1) ? MEMPOOL_F_SP_PUT | MEMPOOL_F_SC_GET : 0;
+
+	snprintf(buf, sizeof(buf), "mbuf_pool_%u", socket);
+
+	if ((sconf->pool = rte_mempool_create(buf, sconf->nb_mbuf, MBUF_SIZE, 0,
+			sizeof(struct rte_pktmbuf_pool_private),
+			rte_pktmbuf_pool_init, NULL, rte_pktmbuf_init, NULL,
+			socket, flags)) == NULL) {
+		RTE_LOG(ERR, IP_RSMBL, "mempool_create(%s) failed(%u, %ju)", buf,
+			sconf->nb_mbuf, MBUF_SIZE);
 		return -1;
 	}
-	RTE_LOG(ERR, IP_FRAG, "Direct_pool %p\n", direct_pool); 
 
-	indirect_pool = rte_pktmbuf_pool_create(INDIR_MP_NAME, NB_MBUF, 32, 0, 0,
+	snprintf(buf, sizeof(buf), DIR_MP_NAME "_%u", socket);
+
+	sconf->direct_pool = rte_pktmbuf_pool_create(buf,
+			NB_MBUF * sconf->nb_lcore, 32, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
 			socket);
-	if (indirect_pool == NULL) {
+	if (sconf->direct_pool == NULL) {
+		RTE_LOG(ERR, IP_FRAG, "Cannot create direct mempool\n");
+		return -1;
+	}
+	RTE_LOG(ERR, IP_FRAG, "Direct_pool %p\n", sconf->direct_pool); 
+
+	snprintf(buf, sizeof(buf), INDIR_MP_NAME "_%u", socket);
+
+	sconf->indirect_pool = rte_pktmbuf_pool_create(buf,
+			NB_MBUF * sconf->nb_lcore, 32, 0, 0, socket);
+	if (sconf->indirect_pool == NULL) {
 		RTE_LOG(ERR, IP_FRAG, "Cannot create indirect mempool\n");
 		return -1;
 	}
-	RTE_LOG(ERR, IP_FRAG, "Indirect_pool %p\n", indirect_pool); 
+	RTE_LOG(ERR, IP_FRAG, "Indirect_pool %p\n", sconf->indirect_pool); 
+
+	if (sconf->nb_copy != 0) {
+		snprintf(buf, sizeof(buf), COPY_MP_NAME "_%u", socket);
+
+		/* each buffer takes a jumbo datagram past the headroom. */
+		sconf->copy_pool = rte_pktmbuf_pool_create(buf, sconf->nb_copy,
+				32, 0, RTE_PKTMBUF_HEADROOM + JUMBO_FRAME_MAX_SIZE,
+				socket);
+		if (sconf->copy_pool == NULL) {
+			RTE_LOG(ERR, IP_FRAG, "Cannot create copy mempool\n");
+			return -1;
+		}
+	}
+
+	if (app_config.id_mode >= 0) {
+		sconf->id_gen = rte_ip_frag_id_gen_create(app_config.id_mode,
+				ID_GEN_COUNTERS, socket);
+		if (sconf->id_gen == NULL) {
+			RTE_LOG(ERR, IP_FRAG, "Cannot create fragment id generator\n");
+			return -1;
+		}
+	}
+
+	if (app_config.pmtu != 0) {
+		sconf->pmtu = rte_ip_frag_pmtu_create(PMTU_ENTRIES, 0, socket);
+		if (sconf->pmtu == NULL) {
+			RTE_LOG(ERR, IP_FRAG, "Cannot create path MTU cache\n");
+			return -1;
+		}
+
+		/* as if the control plane had learned it. */
+		rte_ipv4_frag_pmtu_update(sconf->pmtu, TEST_DST_ADDR,
+			app_config.pmtu, 0);
+	}
+
+	RTE_LOG(NOTICE, IP_RSMBL, "socket %u: %u lcores, %u mbufs, "
+		"fragment tables %zu bytes\n", socket, sconf->nb_lcore,
+		sconf->nb_mbuf, sconf->tbl_bytes);
+
+	return 0;
+}
+
+static int
+setup_pools(void)
+{
+	uint32_t socket;
+
+	for (socket = 0; socket != RTE_MAX_NUMA_NODES; socket++) {
+		if (socket_conf[socket].nb_lcore == 0)
+			continue;
+
+		if (setup_socket_pools(socket) < 0)
+			return -1;
+	}
 
 	return 0;
 }
@@ -913,14 +2078,39 @@ main(int argc, char **argv)
 	printf("Set log level %d\n", app_config.log_level);
 	rte_set_log_level(app_config.log_level);
 
+	if (app_config.hash_bench != 0)
+		return hash_bench();
+
 	if (setup_ring() < 0)
 		rte_exit(EXIT_FAILURE, "setup_ring failed\n");
 
-	if (setup_queue_tbl(0, 0) < 0)
-		rte_exit(EXIT_FAILURE, "fail to init reassembly\n");
+	RTE_LCORE_FOREACH(lcore_id) {
+		if (setup_queue_tbl(lcore_id, 0) < 0)
+			rte_exit(EXIT_FAILURE, "fail to init reassembly\n");
+	}
+
+	if (setup_pools() < 0)
+		rte_exit(EXIT_FAILURE, "fail to init mbuf pools\n");
+
+	/* copy pools exist only now, tables are still empty. */
+	if (app_config.copy) {
+		RTE_LCORE_FOREACH(lcore_id) {
+			struct lcore_queue_conf *qconf = &lcore_queue_conf[lcore_id];
+
+			if (rte_ip_frag_table_set_copy(qconf->frag_tbl,
+					qconf->sconf->copy_pool) != 0)
+				rte_exit(EXIT_FAILURE, "fail to init copy mode\n");
+		}
+	}
+
+	if (app_config.lookup_bench != 0)
+		return lookup_bench();
+
+	if (app_config.cache_bench != 0)
+		return cache_bench();
 
-	if (setup_frag() < 0)
-		rte_exit(EXIT_FAILURE, "fail to init fragmentation\n");
+	if (app_config.burst_check != 0)
+		return burst_check();
 
 
 	signal(SIGUSR1, signal_handler);